@@ -0,0 +1,69 @@
+#include <cstdint>
+#include <iostream>
+
+#include "CLI11/CLI11.hpp"
+
+#include "candidates.hpp"
+#include "sector.hpp"
+
+using namespace mcarve;
+
+int main(int argc, char *argv[]) {
+
+    CLI::App app{"Print a pass 1 candidate index in human-readable form"};
+
+    struct {
+        std::string input;
+        bool records;
+    } conf;
+
+    conf.records = false;
+    app.add_option("-i,--input,input", conf.input, "Candidate index file")
+        ->required()
+        ->check(CLI::ExistingFile);
+    app.add_flag("-r,--records", conf.records,
+                 "Print every field of every record, one record per line");
+
+    CLI11_PARSE(app, argc, argv);
+
+    CandidateIndex index(conf.input);
+
+    if (!conf.records) {
+        CandidateTextWriter text(std::cout);
+        text.write(index.records());
+        return 0;
+    }
+
+    const auto &header = index.header();
+    std::cout << "# version " << header.version << ", "
+              << header.record_count << " records, timestamps "
+              << header.min_time << ".." << header.max_time
+              << (header.flags & CANDIDATE_INDEX_FINISHED ? ""
+                                                          : ", unfinished")
+              << "\n";
+    for (const auto &rec : index.records()) {
+        std::cout << rec.blknum << ":";
+        if (rec.types & SECTOR_OFFSETS) {
+            std::cout << " offsets";
+        }
+        if (rec.types & SECTOR_TIMESTAMPS) {
+            std::cout << " timestamps";
+        }
+        if (rec.types & SECTOR_CHUNK) {
+            std::cout << " chunk length=" << rec.chunk_length;
+        }
+        if (rec.types & SECTOR_CHUNK_VALID) {
+            std::cout << " valid";
+        }
+        if (rec.types & SECTOR_CHUNK_COORDS) {
+            std::cout << " x=" << rec.x_pos << " z=" << rec.z_pos;
+        }
+        if (rec.presence_hash != 0) {
+            std::cout << " presence=" << std::hex << rec.presence_hash
+                      << std::dec;
+        }
+        std::cout << "\n";
+    }
+
+    return 0;
+}
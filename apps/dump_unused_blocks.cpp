@@ -1,109 +1,334 @@
+#include <algorithm>
+#include <cerrno>
+#include <climits>
 #include <cstdint>
-#include <fstream>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
-#include <map>
 #include <memory>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <thread>
 #include <vector>
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
 #include "CLI11/CLI11.hpp"
 
 #include "ext2filesystem.hpp"
+#include "parallel.hpp"
+#include "sector.hpp"
 
 using namespace mcarve;
 
+//! Frees buffers from aligned_alloc().
+struct AlignedFree {
+    void operator()(unsigned char *p) const { free(p); }
+};
+using AlignedBuffer = std::unique_ptr<unsigned char[], AlignedFree>;
+
+//! Recycles the page-aligned batch buffers, so that the pages of a buffer
+//! are faulted in once rather than for every batch.
+class BufferPool {
+  public:
+    explicit BufferPool(std::size_t size) : m_size(size) {}
+
+    AlignedBuffer acquire() {
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            if (!m_free.empty()) {
+                AlignedBuffer buf = std::move(m_free.back());
+                m_free.pop_back();
+                return buf;
+            }
+        }
+        auto *p = static_cast<unsigned char *>(aligned_alloc(4096, m_size));
+        if (p == nullptr) {
+            throw std::bad_alloc();
+        }
+        return AlignedBuffer(p);
+    }
+
+    void release(AlignedBuffer buf) {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_free.push_back(std::move(buf));
+    }
+
+  private:
+    std::size_t m_size;
+    std::mutex m_mtx;
+    std::vector<AlignedBuffer> m_free;
+};
+
+//! A run of free blocks read and tested by a worker.
+struct Batch {
+    uint64_t first = 0;
+    uint64_t count = 0;
+    AlignedBuffer data;
+    //! Nonzero blocks as [begin, end) pairs of indices into the batch.
+    std::vector<std::pair<uint32_t, uint32_t>> runs;
+};
+
+void read_all(int fd, unsigned char *data, std::size_t size, off_t offset) {
+    while (size > 0) {
+        ssize_t n = pread(fd, data, size, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            throw std::runtime_error(
+                "Failed to read image at " + std::to_string(offset) + ": " +
+                (n == 0 ? "unexpected end of file" : strerror(errno)));
+        }
+        data += n;
+        size -= n;
+        offset += n;
+    }
+}
+
+//! Writes all of `iov`, which it modifies.
+void write_all(int fd, std::vector<iovec> &iov) {
+    std::size_t first = 0;
+    while (first < iov.size()) {
+        const int count = std::min<std::size_t>(iov.size() - first, IOV_MAX);
+        ssize_t n = writev(fd, iov.data() + first, count);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            throw std::runtime_error(std::string("Write error: ") +
+                                     strerror(errno));
+        }
+        for (std::size_t done = n; done > 0;) {
+            const std::size_t step = std::min(done, iov[first].iov_len);
+            iov[first].iov_base =
+                static_cast<char *>(iov[first].iov_base) + step;
+            iov[first].iov_len -= step;
+            done -= step;
+            if (iov[first].iov_len == 0) {
+                ++first;
+            }
+        }
+        while (first < iov.size() && iov[first].iov_len == 0) {
+            ++first;
+        }
+    }
+}
+
+//! Writes a run of blocks at its offset in the sparse image.
+void pwrite_all(int fd, const unsigned char *data, std::size_t size,
+                off_t offset) {
+    while (size > 0) {
+        ssize_t n = pwrite(fd, data, size, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            throw std::runtime_error(std::string("Write error: ") +
+                                     strerror(errno));
+        }
+        data += n;
+        size -= n;
+        offset += n;
+    }
+}
+
+//! Opens an output file for writing, or returns -1 for an empty name.
+int open_output(const std::string &filename) {
+    if (filename.empty()) {
+        return -1;
+    }
+    int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        throw std::runtime_error("Couldn't open output file " + filename +
+                                 ": " + strerror(errno));
+    }
+    return fd;
+}
+
 int main(int argc, char *argv[]) {
 
     CLI::App app{
         "Dump unused, nonzero data blocks from ext2/3/4 filesystem image"};
 
     struct {
-        std::string input, output, table;
-        bool verbose;
+        std::string input, output, table, sparse;
+        unsigned threads;
+        unsigned batch_mib = 4;
+        unsigned memory_mib = 1024;
+        bool verbose = false;
     } conf;
+    conf.threads = std::max(1u, std::thread::hardware_concurrency());
 
     app.add_option("-i,--input,input", conf.input, "Ext2/3/4 filesystem image")
         ->required()
         ->check(CLI::ExistingFile);
     app.add_option("-o,--output", conf.output, "Unused block data output");
     app.add_option("-t,--table", conf.table, "Unused block id output");
+    app.add_option("-s,--sparse", conf.sparse,
+                   "Sparse image output: a file the size of the input with "
+                   "the unused, nonzero blocks at their own offsets and holes "
+                   "elsewhere");
+    app.add_option("-j,--threads", conf.threads, "Number of reader threads")
+        ->capture_default_str()
+        ->check(CLI::PositiveNumber);
+    app.add_option("--batch", conf.batch_mib, "Read size in MiB")
+        ->capture_default_str()
+        ->check(CLI::Range(1, 1024));
+    app.add_option("--memory", conf.memory_mib,
+                   "Memory for the batches in flight in MiB, counting the "
+                   "one being written; fewer threads run if it holds fewer "
+                   "batches than -j + 1")
+        ->capture_default_str()
+        ->check(CLI::PositiveNumber);
     app.add_flag("-v,--verbose", conf.verbose, "Print verbose output");
 
     CLI11_PARSE(app, argc, argv);
 
-    if (conf.output == "" && conf.table == "") {
+    if (conf.output == "" && conf.table == "" && conf.sparse == "") {
         std::cerr << argv[0]
                   << ": You must specify an output mode via --output, --table, "
-                     "or both."
+                     "--sparse, or several of them."
                   << std::endl;
         return EXIT_FAILURE;
     }
 
     Ext2Filesystem fs(conf.input);
+    const uint64_t blocksize = fs.blocksize();
 
-    std::ofstream data_output;
-    std::ofstream id_output;
-    bool writing_blocks = false;
-    bool writing_ids = false;
+    // The bitmaps come from libext2fs, but the blocks are read with pread(),
+    // which the worker threads can do concurrently.
+    int image_fd = open(conf.input.c_str(), O_RDONLY);
+    if (image_fd == -1) {
+        std::cerr << argv[0] << ": Couldn't open " << conf.input << std::endl;
+        return EXIT_FAILURE;
+    }
+    posix_fadvise(image_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
 
-    if (conf.output != "") {
-        writing_blocks = true;
-        data_output.open(conf.output, std::ios::binary);
-        if (!data_output.is_open()) {
-            std::cerr << argv[0] << ": Couldn't open block data output file."
-                      << std::endl;
-            return 1;
+    int data_fd = -1;
+    int id_fd = -1;
+    int sparse_fd = -1;
+    try {
+        data_fd = open_output(conf.output);
+        id_fd = open_output(conf.table);
+        sparse_fd = open_output(conf.sparse);
+        // The file is new, so every block not written below stays a hole.
+        struct stat st;
+        if (sparse_fd != -1 &&
+            (fstat(image_fd, &st) != 0 || ftruncate(sparse_fd, st.st_size))) {
+            throw std::runtime_error("Couldn't size sparse output file " +
+                                     conf.sparse + ": " + strerror(errno));
         }
+    } catch (const std::exception &e) {
+        std::cerr << argv[0] << ": " << e.what() << std::endl;
+        return EXIT_FAILURE;
     }
 
-    if (conf.table != "") {
-        writing_ids = true;
-        id_output.open(conf.table, std::ios::binary);
-        if (!id_output.is_open()) {
-            std::cerr << argv[0] << ": Couldn't open block id output file."
-                      << std::endl;
-            return 1;
+    // Split the free extents into batches of up to --batch MiB.
+    const uint64_t batch_blocks =
+        std::max<uint64_t>(1, (uint64_t{conf.batch_mib} << 20) / blocksize);
+    std::vector<BlockExtent> batches;
+    uint64_t free_blocks = 0;
+    for (const auto &extent :
+         fs.free_extents(fs.first_data_block(), fs.blocks_count())) {
+        free_blocks += extent.length;
+        for (uint64_t start = extent.start; start < extent.end();
+             start += batch_blocks) {
+            batches.push_back(
+                {start, std::min(batch_blocks, extent.end() - start)});
         }
     }
 
-    std::vector<char> block_buffer(4096);
-
-    auto max_blk = fs.blocks_count();
-
-    for (uint64_t blk = fs.first_data_block(); blk < max_blk; ++blk) {
-        if (fs.block_is_used(blk)) {
-            continue;
-        }
-        fs.read_block(blk, block_buffer.data(), 1);
+    BufferPool pool(batch_blocks * blocksize);
+    uint64_t written_blocks = 0;
+    std::vector<iovec> iov;
+    std::vector<uint64_t> ids;
 
-        bool allZeroes = std::all_of(block_buffer.begin(), block_buffer.end(),
-                                     [](char c) { return c == 0; });
-        if (allZeroes) {
-            continue;
+    // Workers read and test the batches.  The calling thread writes them in
+    // block order, straight from the batch buffers.
+    auto work = [&](std::size_t i) {
+        Batch batch;
+        batch.first = batches[i].start;
+        batch.count = batches[i].length;
+        batch.data = pool.acquire();
+        read_all(image_fd, batch.data.get(), batch.count * blocksize,
+                 batch.first * blocksize);
+        for (uint32_t k = 0; k < batch.count; ++k) {
+            std::span<const unsigned char> block(
+                batch.data.get() + k * blocksize, blocksize);
+            if (is_all_zero(block)) {
+                continue;
+            }
+            if (!batch.runs.empty() && batch.runs.back().second == k) {
+                ++batch.runs.back().second;
+            } else {
+                batch.runs.push_back({k, k + 1});
+            }
         }
+        return batch;
+    };
 
-        if (writing_ids) {
-            id_output.write(reinterpret_cast<const char *>(&blk), sizeof(blk));
+    auto emit = [&](Batch batch) {
+        iov.clear();
+        ids.clear();
+        for (auto [begin, end] : batch.runs) {
+            iov.push_back({batch.data.get() + begin * blocksize,
+                           (end - begin) * blocksize});
+            for (uint32_t k = begin; k < end; ++k) {
+                ids.push_back(batch.first + k);
+            }
         }
-
-        if (writing_blocks) {
-            data_output.write(block_buffer.data(), block_buffer.size());
+        if (id_fd != -1 && !ids.empty()) {
+            std::vector<iovec> id_iov{
+                {ids.data(), ids.size() * sizeof(uint64_t)}};
+            write_all(id_fd, id_iov);
         }
-
-        bool errcheck = ((blk % 1024) == 0);
-        if (errcheck) {
-            if (id_output.bad() || data_output.bad()) {
-                std::cerr << argv[0] << ": Write error" << std::endl;
-                return EXIT_FAILURE;
+        if (sparse_fd != -1) {
+            for (auto [begin, end] : batch.runs) {
+                pwrite_all(sparse_fd, batch.data.get() + begin * blocksize,
+                           (end - begin) * blocksize,
+                           (batch.first + begin) * blocksize);
             }
         }
+        if (data_fd != -1) {
+            write_all(data_fd, iov);
+        }
+        written_blocks += ids.size();
+        pool.release(std::move(batch.data));
+    };
+
+    // Every batch in flight holds a buffer, so the window of batches is
+    // bounded by --memory rather than by the thread count alone.  The batch
+    // being emitted holds one more buffer outside the window.
+    const uint64_t buffers =
+        (uint64_t{conf.memory_mib} << 20) / (batch_blocks * blocksize);
+    const std::size_t window = buffers > 1 ? buffers - 1 : 1;
+    const unsigned threads = std::min<std::size_t>(conf.threads, window);
+
+    try {
+        ordered_parallel_for<Batch>(batches.size(), threads, work, emit,
+                                    window);
+    } catch (const std::exception &e) {
+        std::cerr << argv[0] << ": " << e.what() << std::endl;
+        return EXIT_FAILURE;
     }
 
-    id_output.flush();
-    data_output.flush();
-    if (id_output.bad() || data_output.bad()) {
+    close(image_fd);
+    if ((data_fd != -1 && close(data_fd) != 0) ||
+        (id_fd != -1 && close(id_fd) != 0) ||
+        (sparse_fd != -1 && close(sparse_fd) != 0)) {
         std::cerr << argv[0] << ": Write error" << std::endl;
         return EXIT_FAILURE;
     }
 
+    if (conf.verbose) {
+        std::cerr << free_blocks << " unused blocks read, " << written_blocks
+                  << " nonzero blocks dumped" << std::endl;
+    }
+
     return 0;
 }
@@ -0,0 +1,507 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <zlib.h>
+
+#include "CLI11/CLI11.hpp"
+
+#include "BlockReader.hpp"
+#include "ext2filesystem.hpp"
+#include "parallel.hpp"
+#include "reassemble.hpp"
+#include "synthetic.hpp"
+
+using namespace mcarve;
+
+// Region files were last saved between these times.
+constexpr uint32_t MIN_SAVE_TIME = 1325376000; // 2012-01-01
+constexpr uint32_t MAX_SAVE_TIME = 1704067200; // 2024-01-01
+// Chunks of a region were saved within this long of each other.
+constexpr uint32_t SAVE_SPREAD = 7 * 24 * 3600;
+
+//! Parses a byte count such as 4096, 512M or 100G.  The suffixes K, M, G and
+//! T are powers of 1024.
+uint64_t parse_size(const std::string &text) {
+    std::size_t end = 0;
+    uint64_t size = std::stoull(text, &end);
+    if (end + 1 == text.size()) {
+        const std::string units = "KMGT";
+        auto unit = units.find(toupper(text[end]));
+        if (unit == std::string::npos) {
+            throw std::runtime_error("Bad size: " + text);
+        }
+        size <<= 10 * (unit + 1);
+    } else if (end != text.size()) {
+        throw std::runtime_error("Bad size: " + text);
+    }
+    return size;
+}
+
+//! Parses "MIN-MAX", or "N" for MIN = MAX = N.
+std::pair<uint32_t, uint32_t> parse_range(const std::string &text) {
+    std::size_t end = 0;
+    const uint32_t min = std::stoul(text, &end);
+    uint32_t max = min;
+    if (end < text.size()) {
+        if (text[end] != '-') {
+            throw std::runtime_error("Bad range: " + text);
+        }
+        std::size_t more = 0;
+        max = std::stoul(text.substr(end + 1), &more);
+        if (end + 1 + more != text.size()) {
+            throw std::runtime_error("Bad range: " + text);
+        }
+    }
+    if (min > max) {
+        throw std::runtime_error("Bad range: " + text);
+    }
+    return {min, max};
+}
+
+uint32_t uniform(std::mt19937 &rng, std::pair<uint32_t, uint32_t> range) {
+    return std::uniform_int_distribution<uint32_t>(range.first,
+                                                   range.second)(rng);
+}
+
+//! Returns a random number below n, which may exceed 32 bits.
+uint64_t below(std::mt19937 &rng, uint64_t n) {
+    return std::uniform_int_distribution<uint64_t>(0, n - 1)(rng);
+}
+
+void put_be32(unsigned char *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+//! A region file as the game would have left it, before it was deleted.
+struct Region {
+    int32_t region_x;
+    int32_t region_z;
+    uint32_t chunks;
+    //! The whole file: both header sectors and the chunk sectors.
+    std::vector<unsigned char> data;
+    //! Where it was planted, sorted by sector.
+    std::vector<RegionExtent> extents;
+
+    uint32_t sectors() const { return data.size() / BLOCKSIZE; }
+};
+
+//! Generates a region file with `chunks` chunks at random positions of the
+//! region, saved in random order.  Now and then the sectors of a chunk that
+//! grew and moved are left behind with stale data between the chunks.
+//! `coords_last` percent of the chunks have their coordinates at the end.
+Region make_region(int32_t region_x, int32_t region_z, uint32_t chunks,
+                   double coords_last, std::mt19937 &rng) {
+    Region region{region_x, region_z, chunks, {}, {}};
+    std::vector<uint32_t> order(REGION_CHUNKS);
+    std::iota(order.begin(), order.end(), 0);
+    std::shuffle(order.begin(), order.end(), rng);
+    order.resize(chunks);
+
+    auto &data = region.data;
+    data.assign(2 * BLOCKSIZE, 0);
+    const uint32_t saved =
+        MIN_SAVE_TIME + rng() % (MAX_SAVE_TIME - MIN_SAVE_TIME - SAVE_SPREAD);
+    uint32_t sector = 2;
+    for (uint32_t index : order) {
+        if (rng() % 16 == 0) {
+            const uint32_t stale = 1 + rng() % 2;
+            for (uint32_t i = 0; i < stale * BLOCKSIZE; ++i) {
+                data.push_back(rng());
+            }
+            sector += stale;
+        }
+        // 0 puts the coordinates of every chunk first and draws nothing.
+        const bool last =
+            coords_last > 0 && rng() % 10000 < coords_last * 100;
+        const auto chunk = encode_chunk(
+            synthetic_chunk(rng, region_x * 32 + index % 32,
+                            region_z * 32 + index / 32, last),
+            Z_DEFAULT_COMPRESSION);
+        const uint32_t count = chunk_sectors(chunk.size() - 4);
+        put_be32(&data[4 * index], sector << 8 | count);
+        put_be32(&data[BLOCKSIZE + 4 * index], saved + rng() % SAVE_SPREAD);
+        data.insert(data.end(), chunk.begin(), chunk.end());
+        data.resize((sector + count) * BLOCKSIZE, 0);
+        sector += count;
+    }
+    return region;
+}
+
+//! Splits `sectors` sectors into `count` extents at random sectors.
+std::vector<RegionExtent> fragment(uint32_t sectors, uint32_t count,
+                                   std::mt19937 &rng) {
+    count = std::clamp<uint32_t>(count, 1, sectors);
+    std::vector<uint32_t> cuts(sectors - 1);
+    std::iota(cuts.begin(), cuts.end(), 1);
+    for (uint32_t i = 0; i + 1 < count; ++i) {
+        std::swap(cuts[i], cuts[i + rng() % (cuts.size() - i)]);
+    }
+    cuts.resize(count - 1);
+    cuts.push_back(0);
+    cuts.push_back(sectors);
+    std::sort(cuts.begin(), cuts.end());
+    std::vector<RegionExtent> extents;
+    for (uint32_t i = 0; i < count; ++i) {
+        extents.push_back({cuts[i], cuts[i + 1] - cuts[i], 0});
+    }
+    return extents;
+}
+
+//! Tracks the blocks of the image that are taken, whether by the
+//! filesystem or by what was planted.
+class BlockAllocator {
+  public:
+    explicit BlockAllocator(uint64_t blocks, bool used)
+        : m_used(blocks, used), m_free(used ? 0 : blocks) {}
+
+    void set(uint64_t first, uint64_t count, bool used) {
+        for (uint64_t blk = first; blk < first + count; ++blk) {
+            if (m_used[blk] != used) {
+                m_used[blk] = used;
+                used ? --m_free : ++m_free;
+            }
+        }
+    }
+
+    //! Takes `count` free blocks, within `spread` blocks of `hint` when it
+    //! can, as a filesystem keeps the extents of a file together.
+    std::optional<uint64_t> allocate(uint64_t count, uint64_t hint,
+                                     uint64_t spread, std::mt19937 &rng) {
+        const uint64_t blocks = m_used.size();
+        if (count > blocks) {
+            return std::nullopt;
+        }
+        const uint64_t last = blocks - count;
+        auto take = [&](uint64_t first) {
+            if (!is_free(first, count)) {
+                return false;
+            }
+            set(first, count, true);
+            return true;
+        };
+        for (int tries = 0; spread > 0 && tries < 64; ++tries) {
+            const uint64_t low = hint > spread ? hint - spread : 0;
+            const uint64_t first =
+                std::min(last, low + rng() % (2 * spread + 1));
+            if (take(first)) {
+                return first;
+            }
+        }
+        for (int tries = 0; tries < 1024; ++tries) {
+            const uint64_t first = below(rng, last + 1);
+            if (take(first)) {
+                return first;
+            }
+        }
+        // The image is nearly full: look for the first run long enough.
+        uint64_t run = 0;
+        for (uint64_t blk = 0; blk < blocks; ++blk) {
+            run = m_used[blk] ? 0 : run + 1;
+            if (run == count) {
+                set(blk + 1 - count, count, true);
+                return blk + 1 - count;
+            }
+        }
+        return std::nullopt;
+    }
+
+    uint64_t size() const { return m_used.size(); }
+    uint64_t free_blocks() const { return m_free; }
+
+  private:
+    bool is_free(uint64_t first, uint64_t count) const {
+        for (uint64_t blk = first; blk < first + count; ++blk) {
+            if (m_used[blk]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::vector<bool> m_used;
+    uint64_t m_free;
+};
+
+void pwrite_all(int fd, const unsigned char *data, std::size_t size,
+                off_t offset) {
+    while (size > 0) {
+        ssize_t n = pwrite(fd, data, size, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            throw std::runtime_error(std::string("Write error: ") +
+                                     strerror(errno));
+        }
+        data += n;
+        size -= n;
+        offset += n;
+    }
+}
+
+//! Prints an extent the way debugfs does: (sectors):blocks.
+void print_extent(std::ostream &out, const RegionExtent &extent) {
+    out << " (" << extent.sector;
+    if (extent.length > 1) {
+        out << "-" << extent.end() - 1;
+    }
+    out << "):" << extent.blknum;
+    if (extent.length > 1) {
+        out << "-" << extent.blknum + extent.length - 1;
+    }
+}
+
+int main(int argc, char *argv[]) {
+
+    CLI::App app{"Make a test image with deleted, fragmented region files"};
+
+    struct {
+        std::string output;
+        std::string size;
+        bool ext4 = false;
+        std::string manifest;
+        std::string regions_dir;
+        uint32_t regions = 100;
+        std::string chunks = "64-1024";
+        std::string extents = "1-18";
+        uint64_t spread = 65536;
+        double noise = 0;
+        double coords_last = 0;
+        uint32_t seed = 1;
+        unsigned threads;
+    } conf;
+    conf.threads = std::max(1u, std::thread::hardware_concurrency());
+
+    app.add_option("-o,--output,output", conf.output, "Image file to make")
+        ->required();
+    app.add_option("-s,--size", conf.size,
+                   "Size of a raw image, e.g. 100G; it is made sparse, so "
+                   "only the planted blocks take space");
+    app.add_flag("--ext4", conf.ext4,
+                 "Plant into the free blocks of the existing ext2/3/4 image "
+                 "--output, e.g. one made with mkfs.ext4, instead");
+    app.add_option("-m,--manifest", conf.manifest,
+                   "Ground truth output, in the format reassemble prints")
+        ->required();
+    app.add_option("--regions-dir", conf.regions_dir,
+                   "Also write the region files here, to compare against")
+        ->check(CLI::ExistingDirectory);
+    app.add_option("-n,--regions", conf.regions, "Number of region files")
+        ->capture_default_str();
+    app.add_option("--chunks", conf.chunks,
+                   "Chunks per region file, MIN-MAX, drawn uniformly")
+        ->capture_default_str();
+    app.add_option("--extents", conf.extents,
+                   "Extents per region file, MIN-MAX, drawn uniformly")
+        ->capture_default_str();
+    app.add_option("--spread", conf.spread,
+                   "Place the extents of a file within this many blocks of "
+                   "each other when there is room; 0 places them anywhere")
+        ->capture_default_str();
+    app.add_option("--noise", conf.noise,
+                   "Percentage of the remaining free blocks to fill with "
+                   "random data, as other deleted files would")
+        ->capture_default_str()
+        ->check(CLI::Range(0.0, 100.0));
+    app.add_option("--coords-last", conf.coords_last,
+                   "Percentage of chunks whose xPos and zPos follow their "
+                   "sections, so that only inflating the whole chunk finds "
+                   "them")
+        ->capture_default_str()
+        ->check(CLI::Range(0.0, 100.0));
+    app.add_option("--seed", conf.seed, "Random seed")->capture_default_str();
+    app.add_option("-j,--threads", conf.threads,
+                   "Number of threads compressing chunks")
+        ->capture_default_str()
+        ->check(CLI::PositiveNumber);
+
+    CLI11_PARSE(app, argc, argv);
+
+    if (conf.ext4 == !conf.size.empty()) {
+        std::cerr << argv[0] << ": Give either --size or --ext4." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    const auto started = std::chrono::steady_clock::now();
+    std::mt19937 rng(conf.seed);
+    std::vector<Region> planted;
+    uint64_t planted_blocks = 0, noise_blocks = 0;
+
+    try {
+        const auto chunk_range = parse_range(conf.chunks);
+        const auto extent_range = parse_range(conf.extents);
+        if (chunk_range.first < 1 || chunk_range.second > REGION_CHUNKS ||
+            extent_range.first < 1) {
+            throw std::runtime_error("--chunks must lie within 1-1024 and "
+                                     "--extents must be at least 1");
+        }
+
+        // The image, and the blocks in it that are free to plant into.
+        int fd;
+        std::optional<BlockAllocator> blocks;
+        if (conf.ext4) {
+            Ext2Filesystem fs(conf.output);
+            if (fs.blocksize() != BLOCKSIZE) {
+                throw std::runtime_error("The filesystem block size is not " +
+                                         std::to_string(BLOCKSIZE));
+            }
+            blocks.emplace(fs.blocks_count(), true);
+            for (const auto &extent :
+                 fs.free_extents(fs.first_data_block(), fs.blocks_count())) {
+                blocks->set(extent.start, extent.length, false);
+            }
+            fd = open(conf.output.c_str(), O_WRONLY);
+        } else {
+            const uint64_t size = parse_size(conf.size);
+            blocks.emplace(size / BLOCKSIZE, false);
+            fd = open(conf.output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd != -1 && ftruncate(fd, size) != 0) {
+                close(fd);
+                fd = -1;
+            }
+        }
+        if (fd == -1) {
+            throw std::runtime_error("Couldn't open " + conf.output + ": " +
+                                     strerror(errno));
+        }
+
+        // Distinct region coordinates around the origin, like a world.
+        const int32_t side = std::ceil(std::sqrt(double(conf.regions)));
+        std::set<std::pair<int32_t, int32_t>> taken;
+        std::vector<std::pair<int32_t, int32_t>> coords;
+        while (coords.size() < conf.regions) {
+            std::pair<int32_t, int32_t> xz(int32_t(rng() % (2 * side)) - side,
+                                           int32_t(rng() % (2 * side)) - side);
+            if (taken.insert(xz).second) {
+                coords.push_back(xz);
+            }
+        }
+        std::vector<uint32_t> chunk_counts;
+        for (uint32_t i = 0; i < conf.regions; ++i) {
+            chunk_counts.push_back(uniform(rng, chunk_range));
+        }
+
+        // Workers generate the region files, each from its own seed, so that
+        // the image does not depend on the number of threads.  The calling
+        // thread places and writes them.
+        auto work = [&](std::size_t i) {
+            std::seed_seq seed{conf.seed, uint32_t(i)};
+            std::mt19937 region_rng(seed);
+            return make_region(coords[i].first, coords[i].second,
+                               chunk_counts[i], conf.coords_last, region_rng);
+        };
+        auto emit = [&](Region region) {
+            region.extents =
+                fragment(region.sectors(), uniform(rng, extent_range), rng);
+            uint64_t hint = below(rng, blocks->size());
+            for (auto &extent : region.extents) {
+                auto blk =
+                    blocks->allocate(extent.length, hint, conf.spread, rng);
+                if (!blk) {
+                    throw std::runtime_error(
+                        "The image is too small for the region files");
+                }
+                extent.blknum = *blk;
+                hint = extent.blknum + extent.length;
+                pwrite_all(fd, &region.data[extent.sector * BLOCKSIZE],
+                           extent.length * BLOCKSIZE,
+                           extent.blknum * BLOCKSIZE);
+            }
+            planted_blocks += region.sectors();
+            if (!conf.regions_dir.empty()) {
+                const auto path =
+                    std::filesystem::path(conf.regions_dir) /
+                    ("r." + std::to_string(region.region_x) + "." +
+                     std::to_string(region.region_z) + ".mca");
+                std::ofstream out(path, std::ios::binary);
+                out.write(reinterpret_cast<const char *>(region.data.data()),
+                          region.data.size());
+                if (!out) {
+                    throw std::runtime_error("Failed to write " +
+                                             path.string());
+                }
+            }
+            region.data = {};
+            planted.push_back(std::move(region));
+        };
+        ordered_parallel_for<Region>(conf.regions, conf.threads, work, emit);
+
+        // Other deleted files, in runs of up to a megabyte.
+        const auto noise_target =
+            static_cast<uint64_t>(blocks->free_blocks() * conf.noise / 100);
+        std::vector<unsigned char> junk(256 * BLOCKSIZE);
+        while (noise_blocks < noise_target) {
+            const uint64_t count =
+                std::min<uint64_t>(noise_target - noise_blocks,
+                                   1 + rng() % 256);
+            auto blk = blocks->allocate(count, 0, 0, rng);
+            if (!blk) {
+                break;
+            }
+            for (std::size_t i = 0; i < count * BLOCKSIZE; i += 4) {
+                put_be32(&junk[i], rng());
+            }
+            pwrite_all(fd, junk.data(), count * BLOCKSIZE, *blk * BLOCKSIZE);
+            noise_blocks += count;
+        }
+
+        if (close(fd) != 0) {
+            throw std::runtime_error("Failed to write " + conf.output);
+        }
+    } catch (const std::exception &e) {
+        std::cerr << argv[0] << ": " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // The manifest lists the region files by offset table block, as
+    // reassemble does, so that the two can be compared with diff.
+    std::sort(planted.begin(), planted.end(),
+              [](const Region &a, const Region &b) {
+                  return a.extents[0].blknum < b.extents[0].blknum;
+              });
+    std::ofstream manifest(conf.manifest);
+    for (const auto &region : planted) {
+        manifest << region.extents[0].blknum << " r." << region.region_x
+                 << "." << region.region_z << ".mca " << region.chunks << "/"
+                 << region.chunks;
+        for (const auto &extent : region.extents) {
+            print_extent(manifest, extent);
+        }
+        manifest << "\n";
+    }
+    if (!manifest.flush()) {
+        std::cerr << argv[0] << ": Failed to write " << conf.manifest
+                  << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    const double secs = std::chrono::duration<double>(
+                            std::chrono::steady_clock::now() - started)
+                            .count();
+    std::cerr << planted.size() << " region files planted in "
+              << planted_blocks << " blocks, " << noise_blocks
+              << " blocks of noise, in " << secs << " s" << std::endl;
+    return 0;
+}
@@ -0,0 +1,91 @@
+#include <cstdint>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "CLI11/CLI11.hpp"
+
+#include "BlockReader.hpp"
+#include "candidates.hpp"
+#include "continuation.hpp"
+#include "sector.hpp"
+
+using namespace mcarve;
+
+//! Removes the blocks of the candidate records from the extents: a block
+//! that starts a table or a chunk does not continue another chunk.
+std::vector<BlockExtent>
+exclude_candidates(const std::vector<BlockExtent> &extents,
+                   std::span<const CandidateRecord> records) {
+    std::vector<BlockExtent> result;
+    auto rec = records.begin();
+    for (auto extent : extents) {
+        while (rec != records.end() && rec->blknum < extent.start) {
+            ++rec;
+        }
+        for (; rec != records.end() && rec->blknum < extent.end(); ++rec) {
+            if (rec->blknum > extent.start) {
+                result.push_back({extent.start, rec->blknum - extent.start});
+            }
+            extent.length = extent.end() - rec->blknum - 1;
+            extent.start = rec->blknum + 1;
+        }
+        if (extent.length > 0) {
+            result.push_back(extent);
+        }
+    }
+    return result;
+}
+
+int main(int argc, char *argv[]) {
+
+    CLI::App app{"Find the blocks that continue fragmented chunk data"};
+
+    struct {
+        std::string filename;
+        std::string index;
+        unsigned threads;
+    } conf;
+
+    conf.threads = std::max(1u, std::thread::hardware_concurrency());
+    app.add_option("-f,--file,file", conf.filename,
+                   "Image file that was scanned")
+        ->required()
+        ->check(CLI::ExistingFile);
+    app.add_option("-i,--index", conf.index, "Candidate index from mcarve -o")
+        ->required()
+        ->check(CLI::ExistingFile);
+    app.add_option("-j,--threads", conf.threads, "Number of matcher threads")
+        ->capture_default_str()
+        ->check(CLI::PositiveNumber);
+
+    CLI11_PARSE(app, argc, argv);
+
+    CandidateIndex index(conf.index);
+    auto reader = open_image(conf.filename);
+
+    ContinuationMatcher matcher;
+    for (const auto &rec : index.records()) {
+        if (rec.types & SECTOR_CHUNK) {
+            matcher.add_chunk(*reader, rec.blknum);
+        }
+    }
+
+    auto candidates = exclude_candidates(
+        reader->scan_extents(reader->first_blknum(), reader->blocks_count()),
+        index.records());
+
+    ContinuationStats stats;
+    auto found = matcher.match(*reader, candidates, conf.threads, stats);
+
+    for (const auto &c : found) {
+        std::cout << c.chunk_blk << " +" << c.position << ": " << c.next_blk
+                  << "\n";
+    }
+    std::cerr << matcher.size() << " incomplete chunks, " << stats.pairs_tested
+              << " pairs in " << stats.seconds << " s ("
+              << stats.pairs_per_second() << " pairs/s), " << found.size()
+              << " continuations" << std::endl;
+
+    return 0;
+}
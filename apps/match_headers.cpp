@@ -0,0 +1,61 @@
+#include <cstdint>
+#include <iostream>
+
+#include "CLI11/CLI11.hpp"
+
+#include "BlockReader.hpp"
+#include "candidates.hpp"
+#include "header_match.hpp"
+
+using namespace mcarve;
+
+int main(int argc, char *argv[]) {
+
+    CLI::App app{"Pair region file offset tables with their timestamp tables"};
+
+    struct {
+        std::string filename;
+        std::string index;
+    } conf;
+
+    app.add_option("-f,--file,file", conf.filename,
+                   "Image file that was scanned")
+        ->required()
+        ->check(CLI::ExistingFile);
+    app.add_option("-i,--index", conf.index, "Candidate index from mcarve -o")
+        ->required()
+        ->check(CLI::ExistingFile);
+
+    CLI11_PARSE(app, argc, argv);
+
+    CandidateIndex index(conf.index);
+    auto reader = open_image(conf.filename);
+
+    HeaderMatches matches = match_headers(index.records(), *reader);
+
+    for (const auto &pair : matches.pairs) {
+        std::cout << pair.offsets_blk << " " << pair.timestamps_blk
+                  << (pair.adjacent ? "\n" : " nonadjacent\n");
+    }
+    for (const auto &collision : matches.collisions) {
+        std::cout << "# collision" << (collision.full_region ? " (full)" : "")
+                  << ": offsets";
+        for (auto blk : collision.offsets_blks) {
+            std::cout << " " << blk;
+        }
+        std::cout << "; timestamps";
+        for (auto blk : collision.timestamps_blks) {
+            std::cout << " " << blk;
+        }
+        std::cout << "\n";
+    }
+
+    std::cerr << matches.pairs.size() << " pairs, "
+              << matches.collisions.size() << " collisions, "
+              << matches.unmatched_offsets.size()
+              << " unmatched offset tables, "
+              << matches.unmatched_timestamps.size()
+              << " unmatched timestamp tables" << std::endl;
+
+    return 0;
+}
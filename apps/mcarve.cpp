@@ -1,12 +1,25 @@
+#include <algorithm>
+#include <charconv>
+#include <chrono>
 #include <cstdint>
 #include <ctime>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <memory>
+#include <random>
+#include <string_view>
+#include <thread>
 #include <vector>
 
 #include "CLI11/CLI11.hpp"
 
+#include "candidates.hpp"
+#include "checkpoint.hpp"
 #include "ext2filesystem.hpp"
+#include "scan_plan.hpp"
+#include "scan_stats.hpp"
+#include "scanner.hpp"
 #include "sector.hpp"
 
 #include "BlockReader.hpp"
@@ -28,22 +41,212 @@ time_t current_time() {
     return mktime(&tm);
 }
 
+//! Drops the blocks below `from` from sorted extents.
+std::vector<BlockExtent> extents_from(std::vector<BlockExtent> extents,
+                                      uint64_t from) {
+    auto it = std::find_if(
+        extents.begin(), extents.end(),
+        [&](const BlockExtent &extent) { return extent.end() > from; });
+    extents.erase(extents.begin(), it);
+    if (!extents.empty() && extents.front().start < from) {
+        extents.front() = {from, extents.front().end() - from};
+    }
+    return extents;
+}
+
+//! Sorts block ranges and merges those that overlap or touch.
+std::vector<BlockExtent> merge_ranges(std::vector<BlockExtent> ranges) {
+    std::sort(ranges.begin(), ranges.end(),
+              [](const BlockExtent &a, const BlockExtent &b) {
+                  return a.start < b.start;
+              });
+    std::vector<BlockExtent> merged;
+    for (const auto &range : ranges) {
+        if (range.length == 0) {
+            continue;
+        }
+        if (!merged.empty() && range.start <= merged.back().end()) {
+            merged.back().length =
+                std::max(merged.back().end(), range.end()) -
+                merged.back().start;
+        } else {
+            merged.push_back(range);
+        }
+    }
+    return merged;
+}
+
+//! Parses all of `text` as a block number.
+bool parse_block(std::string_view text, uint64_t &blk) {
+    const auto first = text.find_first_not_of(" \t\r");
+    const auto last = text.find_last_not_of(" \t\r");
+    if (first == std::string_view::npos) {
+        return false;
+    }
+    text = text.substr(first, last + 1 - first);
+    auto [end, ec] = std::from_chars(text.data(), text.end(), blk);
+    return ec == std::errc() && end == text.end();
+}
+
+//! Reads block ranges, one "FIRST-LAST" (inclusive) or single block per
+//! line.  Blank lines and lines starting with '#' are skipped.
+std::vector<BlockExtent> read_ranges(const std::string &filename) {
+    std::ifstream in(filename);
+    if (!in) {
+        throw std::runtime_error("Cannot open " + filename);
+    }
+    std::vector<BlockExtent> ranges;
+    std::string line;
+    for (unsigned number = 1; std::getline(in, line); ++number) {
+        const auto start = line.find_first_not_of(" \t\r");
+        if (start == std::string::npos || line[start] == '#') {
+            continue;
+        }
+        const std::string_view text(line);
+        const auto dash = text.find('-');
+        uint64_t first, last;
+        const bool ok =
+            dash == std::string_view::npos
+                ? parse_block(text, first) && parse_block(text, last)
+                : parse_block(text.substr(0, dash), first) &&
+                      parse_block(text.substr(dash + 1), last);
+        if (!ok || last < first) {
+            throw std::runtime_error(filename + ":" + std::to_string(number) +
+                                     ": expected FIRST-LAST: " + line);
+        }
+        ranges.push_back({first, last - first + 1});
+    }
+    return merge_ranges(std::move(ranges));
+}
+
+//! Clips sorted block ranges to [first, last).
+std::vector<BlockExtent> clip_ranges(const std::vector<BlockExtent> &ranges,
+                                     uint64_t first, uint64_t last) {
+    std::vector<BlockExtent> clipped;
+    for (const auto &range : ranges) {
+        const uint64_t start = std::max(range.start, first);
+        const uint64_t end = std::min(range.end(), last);
+        if (start < end) {
+            clipped.push_back({start, end - start});
+        }
+    }
+    return clipped;
+}
+
+//! Splits extents into pieces of at most `piece_blocks` and keeps every
+//! `every`th piece, or else a random `percent` of them.  Pieces of equal
+//! size sample a disk evenly even when its free extents are few and large.
+std::vector<BlockExtent> sample_extents(std::span<const BlockExtent> extents,
+                                        uint64_t piece_blocks, unsigned every,
+                                        double percent, uint64_t &pieces) {
+    std::mt19937_64 rng(1);
+    std::bernoulli_distribution keep(percent / 100);
+    std::vector<BlockExtent> sample;
+    pieces = 0;
+    for (const auto &extent : extents) {
+        for (uint64_t start = extent.start; start < extent.end();
+             start += piece_blocks) {
+            const BlockExtent piece{
+                start, std::min(piece_blocks, extent.end() - start)};
+            if (every > 0 ? pieces % every == 0 : keep(rng)) {
+                sample.push_back(piece);
+            }
+            ++pieces;
+        }
+    }
+    return sample;
+}
+
+//! Prints what a sampled scan found, scaled up to all of `total_blocks`.
+void print_estimate(std::ostream &out, const ScanStats &stats,
+                    uint64_t total_blocks, std::size_t sampled,
+                    uint64_t pieces, double secs) {
+    const double blocks = stats.blocks_read.load();
+    const double scale = blocks > 0 ? total_blocks / blocks : 0;
+    const double gib = blocks * BLOCKSIZE / (1 << 30);
+    const double per_gib = gib > 0 ? 1 / gib : 0;
+    const double total_gib = double(total_blocks) * BLOCKSIZE / (1 << 30);
+    const double timestamps = stats.timestamps.load();
+    const double offsets = stats.offsets.load();
+    const double chunks = stats.chunks.load();
+    const double candidates = stats.candidates.load();
+    const double total_secs = secs * scale;
+
+    const auto flags = out.flags();
+    const auto precision = out.precision();
+    out << std::fixed;
+    out << std::setprecision(2) << "Sampled " << sampled << " of " << pieces
+        << " pieces: " << gib << " of " << total_gib << " GiB to scan, in "
+        << secs << " s (" << std::setprecision(1)
+        << (secs > 0 ? gib * 1024 / secs : 0) << " MiB/s)\n";
+    out << "Per GiB: " << timestamps * per_gib << " timestamps, "
+        << offsets * per_gib << " offsets, " << chunks * per_gib
+        << " chunks; "
+        << (blocks > 0 ? 100 * stats.zero_blocks.load() / blocks : 0)
+        << "% of blocks are zeros\n";
+    out << std::setprecision(0) << "Estimated full scan: "
+        << timestamps * scale << " timestamps, " << offsets * scale
+        << " offsets, " << chunks * scale << " chunks, "
+        << candidates * scale << " candidates, in " << total_secs << " s ("
+        << std::setprecision(1) << total_secs / 3600 << " h)\n";
+    out.flags(flags);
+    out.precision(precision);
+}
+
 int main(int argc, char *argv[]) {
 
     CLI::App app{"Scan filesystem image for minecraft data"};
 
     struct {
         std::string filename;
+        std::string output;
         uint32_t start_time;
         uint32_t stop_time;
+        unsigned threads;
+        unsigned batch_mib;
+        std::string reader;
+        unsigned queue_depth;
+        bool direct;
+        bool validate;
+        bool resume;
+        unsigned checkpoint_secs;
+        std::string stats;
+        double stats_secs;
+        uint64_t first_block;
+        uint64_t last_block;
+        std::string range_file;
+        unsigned sample_every;
+        double sample_percent;
+        std::string plan;
+        std::size_t unit;
+        std::size_t units;
+        std::vector<std::string> parts;
         bool verbose;
     } config;
 
     config.verbose = false;
-    app.add_option("-f,--file,file", config.filename, "Image file to be carved")
-        ->required()
+    config.threads = std::max(1u, std::thread::hardware_concurrency());
+    config.batch_mib = 4;
+    config.reader = "mmap";
+    config.queue_depth = 32;
+    config.direct = false;
+    config.validate = false;
+    config.resume = false;
+    config.checkpoint_secs = 20;
+    config.stats_secs = 10;
+    config.first_block = 0;
+    config.last_block = UINT64_MAX;
+    config.sample_every = 0;
+    config.sample_percent = 0;
+    config.unit = 0;
+    config.units = 0;
+    app.add_option("-f,--file,file", config.filename,
+                   "Image file to be carved (required)")
         ->check(CLI::ExistingFile);
 
+    app.add_option("-o,--output", config.output,
+                   "Write candidates to a binary index instead of stdout");
+
     std::string start_timestr("2008-01-01");
     app.add_option("--start", start_timestr,
                    "Minimum accepted timestamp (YYYY-mm-dd)")
@@ -53,73 +256,400 @@ int main(int argc, char *argv[]) {
     app.add_option("--stop", stop_timestr,
                    "Maximum accepted timestamp (YYYY-mm-dd)")
         ->default_str("current_time");
-    app.add_flag("-v,--verbose", config.verbose, "Print verbose output");
+    app.add_option("-j,--threads", config.threads,
+                   "Number of classifier threads")
+        ->capture_default_str()
+        ->check(CLI::PositiveNumber);
+    app.add_option("--batch", config.batch_mib,
+                   "Size of each read batch in MiB")
+        ->capture_default_str()
+        ->check(CLI::Range(1, 64));
+    app.add_option("--reader", config.reader,
+                   "Block reader for images without an ext2/3/4 filesystem. "
+                   "uring keeps its reads in flight while the calling "
+                   "thread classifies, so it scans on one thread and "
+                   "ignores -j")
+        ->capture_default_str()
+#ifdef MCARVE_HAVE_LIBURING
+        ->check(CLI::IsMember({"file", "mmap", "uring"}));
+    app.add_option("--queue-depth", config.queue_depth,
+                   "Number of reads kept in flight by the uring reader")
+        ->capture_default_str()
+        ->check(CLI::Range(1, 4096));
+    app.add_flag("--direct", config.direct,
+                 "Bypass the page cache (O_DIRECT) with the uring reader");
+#else
+        ->check(CLI::IsMember({"file", "mmap"}));
+#endif
+    app.add_flag("--validate", config.validate,
+                 "Inflate candidate chunks and drop those that are not NBT");
+    app.add_flag(
+        "--resume", config.resume,
+        "Continue an interrupted scan from the checkpoint of its --output");
+    app.add_option("--checkpoint-interval", config.checkpoint_secs,
+                   "Seconds between checkpoints of the --output index, or 0 "
+                   "for none")
+        ->capture_default_str();
+    app.add_option("--stats", config.stats,
+                   "Append scan statistics as JSON lines to this file, e.g. "
+                   "/dev/fd/3");
+    app.add_option("--stats-interval", config.stats_secs,
+                   "Seconds between --stats lines, or 0 for the final line "
+                   "only")
+        ->capture_default_str()
+        ->check(CLI::NonNegativeNumber);
+    auto *first_block = app.add_option("--first-block", config.first_block,
+                                       "First block to scan");
+    auto *last_block = app.add_option("--last-block", config.last_block,
+                                      "Last block to scan (inclusive)");
+    auto *range_file =
+        app.add_option("--range-file", config.range_file,
+                       "Scan only the block ranges listed in this file, one "
+                       "FIRST-LAST (inclusive) per line")
+            ->check(CLI::ExistingFile);
+    auto *every =
+        app.add_option("--sample-every", config.sample_every,
+                       "Estimate the candidates and the time of a full scan "
+                       "by scanning every Nth piece of --batch MiB")
+            ->check(CLI::PositiveNumber);
+    app.add_option("--sample-percent", config.sample_percent,
+                   "Estimate them from a random X% of the pieces instead")
+        ->check(CLI::Range(0.0, 100.0))
+        ->excludes(every);
+    auto *worker =
+        app.add_option("--plan", config.plan,
+                       "Scan one unit of this plan from 'mcarve plan', with "
+                       "its settings, into the partial index --output")
+            ->check(CLI::ExistingFile)
+            ->excludes(first_block, last_block, range_file);
+    app.add_option("--unit", config.unit, "Unit of the --plan to scan")
+        ->capture_default_str()
+        ->needs(worker);
+    app.add_flag("-v,--verbose", config.verbose,
+                 "Print a summary of the scan statistics");
 
-    time_t start_time;
-    time_t stop_time;
+    // A distributed scan: a plan, workers on other hosts, then a merge.
+    auto *plan_cmd = app.add_subcommand(
+        "plan", "Split the scan into units of about equal numbers of blocks "
+                "to scan, for workers on hosts with copies of the image");
+    plan_cmd->add_option("-n,--units", config.units, "Number of units")
+        ->required()
+        ->check(CLI::PositiveNumber);
+    plan_cmd->add_option("-p,--plan", config.plan, "Plan file to write")
+        ->required();
+    plan_cmd->fallthrough();
+    auto *merge_cmd = app.add_subcommand(
+        "merge", "Merge the partial indexes of the units of a plan into the "
+                 "--output index of the whole scan");
+    merge_cmd->add_option("-p,--plan", config.plan, "The plan")
+        ->required()
+        ->check(CLI::ExistingFile);
+    merge_cmd
+        ->add_option("parts", config.parts,
+                     "Partial indexes, in unit order")
+        ->required()
+        ->check(CLI::ExistingFile);
+    merge_cmd->fallthrough();
+    app.require_subcommand(0, 1);
 
-    start_time = parse_time(start_timestr);
-    if (stop_timestr == "current_time") {
-        stop_time = current_time();
-    } else {
-        stop_time = parse_time(stop_timestr);
+    CLI11_PARSE(app, argc, argv);
+
+    if (*merge_cmd) {
+        if (config.output.empty()) {
+            std::cerr << argv[0] << ": merge needs the --output index"
+                      << std::endl;
+            return EXIT_FAILURE;
+        }
+        try {
+            merge_scan_indexes(load_scan_plan(config.plan), config.parts,
+                               config.output);
+        } catch (const std::exception &e) {
+            std::cerr << argv[0] << ": " << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+        return 0;
+    }
+    if (config.filename.empty()) {
+        std::cerr << argv[0] << ": --file is required" << std::endl;
+        return EXIT_FAILURE;
+    }
+    const bool working = !*plan_cmd && !config.plan.empty();
+    if (working && config.output.empty()) {
+        std::cerr << argv[0] << ": --plan needs the partial --output index"
+                  << std::endl;
+        return EXIT_FAILURE;
     }
 
-    config.start_time = start_time;
-    config.stop_time = stop_time;
+    try {
+        config.start_time = parse_time(start_timestr);
+        config.stop_time = stop_timestr == "current_time"
+                               ? current_time()
+                               : parse_time(stop_timestr);
+    } catch (const std::exception &e) {
+        std::cerr << argv[0] << ": " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    const bool sampling =
+        config.sample_every > 0 || config.sample_percent > 0;
+    if (sampling && (config.resume || !config.output.empty() ||
+                     !config.plan.empty())) {
+        const char *flag = config.resume          ? "--resume"
+                           : !config.plan.empty() ? "--plan"
+                                                  : "--output";
+        std::cerr << argv[0] << ": A sampled scan only estimates; it cannot "
+                  << "be combined with " << flag << std::endl;
+        return EXIT_FAILURE;
+    }
 
-    CLI11_PARSE(app, argc, argv);
+    if (config.resume && config.output.empty()) {
+        std::cerr << argv[0]
+                  << ": --resume needs the --output of the interrupted scan"
+                  << std::endl;
+        return EXIT_FAILURE;
+    }
 
     std::unique_ptr<BlockReader> reader;
     if (IdentifyExt2FS(config.filename)) {
         reader = std::make_unique<Ext2BlockReader>(config.filename);
-    } else {
+#ifdef MCARVE_HAVE_LIBURING
+    } else if (config.reader == "uring") {
+        IoUringBlockReader::Options uring_opts;
+        uring_opts.queue_depth = config.queue_depth;
+        uring_opts.direct = config.direct;
+        uring_opts.register_buffers = true;
+        reader = std::make_unique<IoUringBlockReader>(config.filename,
+                                                      uring_opts);
+        // Only a serial scan goes through stream_blocks().  Shards would
+        // read under the reader lock, one synchronous read at a time.
+        config.threads = 1;
+#endif
+    } else if (config.reader == "file") {
         reader = std::make_unique<FileBlockReader>(config.filename);
+    } else {
+        reader = std::make_unique<MmapBlockReader>(config.filename);
     }
 
-    std::vector<uint64_t> timestamp_offsets;
-    std::vector<uint64_t> offset_offsets;
-    std::vector<uint64_t> chunk_offsets;
+    // The ranges to scan, within the blocks that the reader has.
+    const uint64_t first_blk =
+        std::max(config.first_block, reader->first_blknum());
+    const uint64_t end_blk =
+        config.last_block < reader->blocks_count() ? config.last_block + 1
+                                                   : reader->blocks_count();
+    std::vector<BlockExtent> ranges;
+    try {
+        ranges = config.range_file.empty()
+                     ? std::vector<BlockExtent>{{0, UINT64_MAX}}
+                     : read_ranges(config.range_file);
+    } catch (const std::exception &e) {
+        std::cerr << argv[0] << ": " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    ranges = clip_ranges(ranges, first_blk, end_blk);
 
-    auto max_blk = reader->blocks_count();
-    if (max_blk > 400000) {
-        max_blk = 400000;
+    ScanOptions scan_opts;
+    scan_opts.min_time = config.start_time;
+    scan_opts.max_time = config.stop_time;
+    scan_opts.threads = config.threads;
+    scan_opts.validate_chunks = config.validate;
+    scan_opts.shard_blocks = config.batch_mib * (uint64_t{1} << 20) / BLOCKSIZE;
+
+    // A worker takes its blocks and settings from the plan.
+    ScanPlan work_plan;
+    if (working) {
+        try {
+            work_plan = load_scan_plan(config.plan);
+            const ScanPlan &plan = work_plan;
+            if (plan.blocks_count != reader->blocks_count()) {
+                throw std::runtime_error("The plan is of an image of " +
+                                         std::to_string(plan.blocks_count) +
+                                         " blocks");
+            }
+            if (config.unit >= plan.units.size()) {
+                throw std::runtime_error(
+                    "The plan has " + std::to_string(plan.units.size()) +
+                    " units, numbered from 0");
+            }
+            ranges = plan.unit_ranges(config.unit);
+            scan_opts.min_time = plan.min_time;
+            scan_opts.max_time = plan.max_time;
+            scan_opts.shard_blocks = plan.shard_blocks;
+            scan_opts.validate_chunks = plan.validate_chunks;
+        } catch (const std::exception &e) {
+            std::cerr << argv[0] << ": " << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
     }
-    BlockBuffer sector_buffer;
 
-    int chunk_header_count = 0;
-    for (blk64_t blk = reader->first_blknum(); blk < max_blk; ++blk) {
-        if (reader->is_allocated(blk)) {
-            continue;
+    ScanStats stats;
+    std::unique_ptr<ScanStatsReporter> reporter;
+    const auto scan_start = std::chrono::steady_clock::now();
+    if (!config.stats.empty()) {
+        reporter = std::make_unique<ScanStatsReporter>(
+            stats, config.stats,
+            std::chrono::milliseconds(
+                static_cast<int64_t>(config.stats_secs * 1000)));
+    }
+    if (reporter || config.verbose) {
+        scan_opts.stats = &stats;
+    }
+    auto finish_stats = [&]() {
+        if (reporter) {
+            reporter->finish();
         }
-        reader->read_block(blk, sector_buffer);
-        if (has_timestamps(sector_buffer, config.start_time,
-                           config.stop_time)) {
-            if (chunk_header_count > 0) {
-                std::cout << "[" << chunk_header_count << "]\n";
-                chunk_header_count = 0;
-            }
-            std::cout << blk << ": timestamps\n";
+        if (config.verbose) {
+            print_scan_stats(std::cerr, stats,
+                             std::chrono::duration<double>(
+                                 std::chrono::steady_clock::now() - scan_start)
+                                 .count());
         }
-        if (has_offsets(sector_buffer)) {
-            if (chunk_header_count > 0) {
-                std::cout << "[" << chunk_header_count << "]\n";
-                chunk_header_count = 0;
-            }
-            std::cout << blk << ": offsets\n";
+    };
+
+    std::vector<BlockExtent> extents;
+    for (const auto &range : ranges) {
+        auto found = find_scan_extents(*reader, range.start, range.end(),
+                                       scan_opts.stats);
+        extents.insert(extents.end(), found.begin(), found.end());
+    }
+    if (working) {
+        try {
+            scan_opts.last_extent_end =
+                unit_extent_end(*reader, work_plan, config.unit, extents);
+        } catch (const std::exception &e) {
+            std::cerr << argv[0] << ": " << e.what() << std::endl;
+            return EXIT_FAILURE;
         }
+    }
 
-        if (has_encoded_chunk(sector_buffer)) {
-            if (chunk_header_count == 0) {
-                std::cout << blk << ": chunk headers: ";
+    if (*plan_cmd) {
+        ScanPlan plan;
+        plan.blocks_count = reader->blocks_count();
+        plan.shard_blocks = scan_opts.shard_blocks;
+        plan.min_time = scan_opts.min_time;
+        plan.max_time = scan_opts.max_time;
+        plan.validate_chunks = scan_opts.validate_chunks;
+        plan.ranges = ranges;
+        try {
+            split_scan_plan(plan, extents, config.units);
+            save_scan_plan(config.plan, plan);
+        } catch (const std::exception &e) {
+            std::cerr << argv[0] << ": " << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+        if (config.verbose) {
+            for (std::size_t i = 0; i < plan.units.size(); ++i) {
+                const auto &unit = plan.units[i];
+                std::cerr << "unit " << i << ": blocks [" << unit.start
+                          << ", " << unit.end << "), " << unit.blocks
+                          << " to scan" << std::endl;
             }
-            chunk_header_count++;
         }
+        finish_stats();
+        return 0;
     }
-    if (chunk_header_count > 0) {
-        std::cout << "[" << chunk_header_count << "]\n";
-        chunk_header_count = 0;
+
+    if (sampling) {
+        uint64_t total_blocks = 0;
+        for (const auto &extent : extents) {
+            total_blocks += extent.length;
+        }
+        uint64_t pieces;
+        const auto sample =
+            sample_extents(extents, scan_opts.shard_blocks,
+                           config.sample_every, config.sample_percent, pieces);
+        scan_opts.stats = &stats;
+        const auto start = std::chrono::steady_clock::now();
+        scan_blocks(*reader, sample, scan_opts,
+                    [](std::span<const CandidateRecord>, uint64_t) {});
+        print_estimate(std::cout, stats, total_blocks, sample.size(), pieces,
+                       std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() - start)
+                           .count());
+        finish_stats();
+        return 0;
     }
 
+    if (config.output.empty()) {
+        CandidateTextWriter text(std::cout);
+        scan_blocks(*reader, extents, scan_opts,
+                    [&](std::span<const CandidateRecord> candidates,
+                        uint64_t) { text.write(candidates); });
+        text.finish();
+        finish_stats();
+        return 0;
+    }
+
+    // The index is checkpointed next to itself.  A resumed scan keeps the
+    // records up to the checkpoint, and takes its settings from it so that
+    // the index comes out the same as that of an uninterrupted scan.
+    const std::string checkpoint_file = config.output + ".checkpoint";
+    const uint64_t scan_first = ranges.empty() ? 0 : ranges.front().start;
+    const uint64_t scan_last = ranges.empty() ? 0 : ranges.back().end();
+    std::unique_ptr<CandidateIndexWriter> index;
+    try {
+        if (config.resume) {
+            const ScanCheckpoint saved = load_checkpoint(checkpoint_file);
+            if (saved.first != scan_first || saved.last != scan_last ||
+                saved.ranges_hash != hash_ranges(ranges)) {
+                throw std::runtime_error(
+                    "The checkpoint is of a scan of other blocks, " +
+                    std::to_string(saved.first) + "-" +
+                    std::to_string(saved.last - 1) +
+                    "; give the same block options");
+            }
+            scan_opts.min_time = saved.min_time;
+            scan_opts.max_time = saved.max_time;
+            scan_opts.shard_blocks = saved.shard_blocks;
+            scan_opts.validate_chunks = saved.validate_chunks;
+            index = std::make_unique<CandidateIndexWriter>(
+                config.output, saved.record_count);
+            extents = extents_from(std::move(extents), saved.scanned_to);
+            if (config.verbose) {
+                std::cerr << "Resuming at block " << saved.scanned_to
+                          << " with " << saved.record_count << " candidates"
+                          << std::endl;
+            }
+        } else {
+            unlink(checkpoint_file.c_str());
+            index = std::make_unique<CandidateIndexWriter>(
+                config.output, scan_opts.min_time, scan_opts.max_time);
+        }
+    } catch (const std::exception &e) {
+        std::cerr << argv[0] << ": " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    ScanCheckpoint checkpoint = make_checkpoint();
+    checkpoint.first = scan_first;
+    checkpoint.last = scan_last;
+    checkpoint.ranges_hash = hash_ranges(ranges);
+    checkpoint.shard_blocks = scan_opts.shard_blocks;
+    checkpoint.min_time = scan_opts.min_time;
+    checkpoint.max_time = scan_opts.max_time;
+    checkpoint.validate_chunks = scan_opts.validate_chunks;
+
+    using Clock = std::chrono::steady_clock;
+    const auto interval = std::chrono::seconds(config.checkpoint_secs);
+    auto last_checkpoint = Clock::now();
+    CheckpointWriter checkpoints(checkpoint_file, *index);
+
+    scan_blocks(*reader, extents, scan_opts,
+                [&](std::span<const CandidateRecord> candidates,
+                    uint64_t scanned_to) {
+                    index->append(candidates);
+                    if (config.checkpoint_secs == 0 ||
+                        Clock::now() - last_checkpoint < interval) {
+                        return;
+                    }
+                    checkpoint.scanned_to = scanned_to;
+                    checkpoint.record_count = index->record_count();
+                    if (checkpoints.submit(checkpoint)) {
+                        last_checkpoint = Clock::now();
+                    }
+                });
+    checkpoints.finish();
+    index->close();
+    checkpoints.remove();
+    finish_stats();
+
     return 0;
 }
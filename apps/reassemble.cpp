@@ -0,0 +1,154 @@
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <vector>
+
+#include "CLI11/CLI11.hpp"
+
+#include "BlockReader.hpp"
+#include "candidates.hpp"
+#include "continuation.hpp"
+#include "header_match.hpp"
+#include "reassemble.hpp"
+#include "region_writer.hpp"
+
+using namespace mcarve;
+
+//! Reads the "chunk +position: next" lines printed by match_continuations.
+std::vector<Continuation> read_continuations(const std::string &filename) {
+    std::ifstream in(filename);
+    if (!in) {
+        throw std::runtime_error("Cannot open " + filename);
+    }
+    std::vector<Continuation> continuations;
+    Continuation c;
+    char plus, colon;
+    while (in >> c.chunk_blk >> plus >> c.position >> colon >> c.next_blk) {
+        continuations.push_back(c);
+    }
+    return continuations;
+}
+
+//! Prints an extent the way debugfs does: (sectors):blocks.
+void print_extent(const RegionExtent &extent) {
+    std::cout << " (" << extent.sector;
+    if (extent.length > 1) {
+        std::cout << "-" << extent.end() - 1;
+    }
+    std::cout << "):" << extent.blknum;
+    if (extent.length > 1) {
+        std::cout << "-" << extent.blknum + extent.length - 1;
+    }
+}
+
+int main(int argc, char *argv[]) {
+
+    CLI::App app{"Piece region files together from pass 1 candidates"};
+
+    struct {
+        std::string filename;
+        std::string index;
+        std::string continuations;
+        std::string output_dir;
+    } conf;
+
+    app.add_option("-f,--file,file", conf.filename,
+                   "Image file that was scanned")
+        ->required()
+        ->check(CLI::ExistingFile);
+    app.add_option("-i,--index", conf.index,
+                   "Candidate index from mcarve -o, preferably with --validate")
+        ->required()
+        ->check(CLI::ExistingFile);
+    app.add_option("-c,--continuations", conf.continuations,
+                   "Output of match_continuations")
+        ->check(CLI::ExistingFile);
+    app.add_option("-o,--output-dir", conf.output_dir,
+                   "Write the region files with any chunks found here")
+        ->check(CLI::ExistingDirectory);
+
+    CLI11_PARSE(app, argc, argv);
+
+    CandidateIndex index(conf.index);
+    auto reader = open_image(conf.filename);
+
+    std::vector<Continuation> continuations;
+    if (!conf.continuations.empty()) {
+        continuations = read_continuations(conf.continuations);
+    }
+
+    HeaderMatches headers = match_headers(index.records(), *reader);
+    Reassembly result = reassemble_regions(index.records(), headers,
+                                           *reader, continuations);
+
+    uint64_t located = 0, ambiguous = 0, complete = 0;
+    for (const auto &region : result.regions) {
+        std::cout << region.offsets_blk << " ";
+        if (region.located) {
+            std::cout << "r." << region.region_x << "." << region.region_z
+                      << ".mca";
+            ++located;
+        } else if (region.rivals > 0) {
+            std::cout << "ambiguous(" << region.rivals + 1 << ")";
+            ++ambiguous;
+        } else {
+            std::cout << "unlocated";
+        }
+        std::cout << " " << region.chunks_found << "/"
+                  << region.chunks_present;
+        if (region.chunks_found == region.chunks_present) {
+            ++complete;
+        }
+        for (const auto &extent : region.extents) {
+            print_extent(extent);
+        }
+        std::cout << "\n";
+    }
+
+    for (const auto &collision : result.collisions) {
+        std::cout << "# collision at " << collision.chunk_blk << ": chunks";
+        for (auto index : collision.sequence) {
+            std::cout << " " << index;
+        }
+        std::cout << " in offset tables";
+        for (auto blk : collision.offsets_blks) {
+            std::cout << " " << blk;
+        }
+        std::cout << "\n";
+    }
+
+    if (!conf.output_dir.empty()) {
+        RegionWriter writer(conf.filename, *reader);
+        std::set<std::string> names;
+        for (const auto &region : result.regions) {
+            if (region.chunks_found == 0) {
+                continue;
+            }
+            // Older copies of a region keep their offset table block in the
+            // name.
+            std::string name = region_filename(region);
+            if (!names.insert(name).second) {
+                name.insert(name.size() - 4,
+                            "." + std::to_string(region.offsets_blk));
+            }
+            writer.write(region,
+                         std::filesystem::path(conf.output_dir) / name);
+        }
+        const auto &stats = writer.stats();
+        std::cerr << stats.files << " region files written, "
+                  << stats.bytes_copied << " bytes copied in the kernel, "
+                  << stats.bytes_buffered << " bytes buffered, "
+                  << stats.chunks_dropped << " incomplete chunks dropped"
+                  << std::endl;
+    }
+
+    std::cerr << result.regions.size() << " offset tables, " << located
+              << " located, " << ambiguous << " ambiguous, " << complete
+              << " complete, " << result.collisions.size()
+              << " sequence collisions (" << result.shared_sequences
+              << " sequences shared by tables)" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,285 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <benchmark/benchmark.h>
+
+#include "BlockReader.hpp"
+#include "corpus.hpp"
+#include "extent.hpp"
+#include "scanner.hpp"
+
+using namespace mcarve;
+
+namespace {
+
+using namespace mcarve::bench;
+
+// 256 MiB, more than the caches but small enough to stay in the page cache,
+// so that the benchmarks measure the readers rather than the disk.
+constexpr uint64_t IMAGE_BLOCKS = 65536;
+// The sparse image alternates holes and data in runs of this many blocks.
+constexpr uint64_t SPARSE_RUN = 256;
+
+//! Layouts of the temporary images.
+enum ImageKind {
+    PLAIN,  //!< Every block written.
+    SPARSE, //!< Every other run of SPARSE_RUN blocks left a hole.
+    EXT2,   //!< An ext2 filesystem with fragmented free space.
+};
+
+//! A temporary image file, deleted at exit.
+class TempImage {
+  public:
+    //! Fills the image with blocks in about the proportions of the free
+    //! space of a disk used for Minecraft: mostly other data and zeros, and
+    //! some region file sectors.  An EXT2 image is then formatted with
+    //! mke2fs and debugfs; if they fail, available() is false.
+    TempImage(ImageKind kind) {
+        const char *dir = std::getenv("TMPDIR");
+        m_path = std::string(dir ? dir : "/tmp") + "/mcarve-bench-XXXXXX";
+        int fd = mkstemp(m_path.data());
+        if (fd == -1) {
+            throw std::runtime_error("Failed to create " + m_path);
+        }
+        std::mt19937 rng(kind == SPARSE);
+        for (uint64_t blk = 0; blk < IMAGE_BLOCKS; ++blk) {
+            if (kind == SPARSE && (blk / SPARSE_RUN) % 2 == 1) {
+                continue;
+            }
+            const unsigned roll = rng() % 100;
+            const Corpus corpus = roll < 50   ? RANDOM
+                                  : roll < 80 ? ZERO
+                                  : roll < 95 ? ZLIB_CHUNK
+                                  : roll < 98 ? NBT
+                                  : roll < 99 ? OFFSETS
+                                              : TIMESTAMPS;
+            const BlockBuffer block = make_block(corpus, rng);
+            if (pwrite(fd, block.data(), BLOCKSIZE, blk * BLOCKSIZE) !=
+                BLOCKSIZE) {
+                close(fd);
+                throw std::runtime_error("Failed to write " + m_path);
+            }
+        }
+        if (ftruncate(fd, IMAGE_BLOCKS * BLOCKSIZE) != 0) {
+            close(fd);
+            throw std::runtime_error("Failed to size " + m_path);
+        }
+        close(fd);
+        m_available = kind != EXT2 || format_ext2(rng);
+    }
+    ~TempImage() { unlink(m_path.c_str()); }
+
+    //! The path of the image, or an empty string if it could not be made.
+    std::string path() const { return m_available ? m_path : ""; }
+
+  private:
+    //! Makes an ext2 filesystem with 4 KiB blocks over the image, keeping
+    //! the contents of its free blocks, then marks runs of 1 to 256 blocks
+    //! in use so that the block bitmap has many free extents.
+    bool format_ext2(std::mt19937 &rng) {
+        const std::string commands = m_path + ".debugfs";
+        {
+            std::ofstream out(commands);
+            for (uint64_t blk = 0; blk < IMAGE_BLOCKS;) {
+                const uint64_t free = 1 + rng() % 256;
+                const uint64_t used = 1 + rng() % 256;
+                blk += free;
+                if (blk >= IMAGE_BLOCKS) {
+                    break;
+                }
+                out << "setb " << blk << " "
+                    << std::min(used, IMAGE_BLOCKS - blk) << "\n";
+                blk += used;
+            }
+        }
+        const std::string command =
+            "PATH=\"$PATH:/sbin:/usr/sbin\"; "
+            "mke2fs -q -F -t ext2 -b 4096 -E nodiscard " +
+            m_path + " >/dev/null 2>&1 && debugfs -w -f " + commands + " " +
+            m_path + " >/dev/null 2>&1";
+        const bool ok = std::system(command.c_str()) == 0;
+        unlink(commands.c_str());
+        return ok;
+    }
+
+    std::string m_path;
+    bool m_available = true;
+};
+
+std::string image_path() {
+    static TempImage image(PLAIN);
+    return image.path();
+}
+
+std::string sparse_image_path() {
+    static TempImage image(SPARSE);
+    return image.path();
+}
+
+std::string ext2_image_path() {
+    static TempImage image(EXT2);
+    return image.path();
+}
+
+enum ReaderKind {
+    FILE_READER,
+    MMAP_READER,
+    MEMORY_READER,
+    URING_READER,
+    EXT2_READER,
+};
+
+//! Opens the ext2 image for EXT2_READER and the plain image for the others.
+//! Returns null if the reader or its image is not available.
+std::unique_ptr<BlockReader> make_reader(ReaderKind kind) {
+    const std::string path = image_path();
+    switch (kind) {
+    case FILE_READER:
+        return std::make_unique<FileBlockReader>(path);
+    case MMAP_READER:
+        return std::make_unique<MmapBlockReader>(path);
+    case MEMORY_READER: {
+        std::ifstream in(path, std::ios::binary);
+        std::vector<unsigned char> data(IMAGE_BLOCKS * BLOCKSIZE);
+        in.read(reinterpret_cast<char *>(data.data()), data.size());
+        return std::make_unique<MemoryBlockReader>(std::move(data));
+    }
+    case URING_READER:
+#ifdef MCARVE_HAVE_LIBURING
+        return std::make_unique<IoUringBlockReader>(path);
+#endif
+        break;
+    case EXT2_READER:
+        if (!ext2_image_path().empty()) {
+            return std::make_unique<Ext2BlockReader>(ext2_image_path());
+        }
+        break;
+    }
+    return nullptr;
+}
+
+//! Fetches the image in runs of `batch` blocks with view_blocks().
+void BM_ViewBlocks(benchmark::State &state) {
+    auto reader = make_reader(static_cast<ReaderKind>(state.range(0)));
+    if (!reader) {
+        state.SkipWithError("reader not available");
+        return;
+    }
+    const uint64_t batch = state.range(1);
+    std::vector<unsigned char> scratch(batch * BLOCKSIZE);
+    uint64_t blk = 0;
+    for (auto _ : state) {
+        if (blk + batch > IMAGE_BLOCKS) {
+            blk = 0;
+        }
+        auto view = reader->view_blocks(blk, batch, scratch);
+        benchmark::DoNotOptimize(view.data());
+        // Touch every page, as a classifier would.
+        for (std::size_t i = 0; i < view.size(); i += BLOCKSIZE) {
+            benchmark::DoNotOptimize(view[i]);
+        }
+        blk += batch;
+    }
+    state.SetBytesProcessed(state.iterations() * batch * BLOCKSIZE);
+}
+
+//! Streams the whole image through stream_blocks().
+void BM_StreamBlocks(benchmark::State &state) {
+    auto reader = make_reader(static_cast<ReaderKind>(state.range(0)));
+    if (!reader) {
+        state.SkipWithError("reader not available");
+        return;
+    }
+    const uint64_t batch = state.range(1);
+    for (auto _ : state) {
+        reader->stream_blocks(
+            0, IMAGE_BLOCKS, batch,
+            [](uint64_t, std::span<const unsigned char> data) {
+                for (std::size_t i = 0; i < data.size(); i += BLOCKSIZE) {
+                    benchmark::DoNotOptimize(data[i]);
+                }
+            });
+    }
+    state.SetBytesProcessed(state.iterations() * IMAGE_BLOCKS * BLOCKSIZE);
+}
+
+//! Runs the whole pass 1 scan over the image.
+void BM_ScanBlocks(benchmark::State &state) {
+    auto reader = make_reader(MMAP_READER);
+    ScanOptions opts;
+    opts.min_time = MIN_TIME;
+    opts.max_time = MAX_TIME;
+    opts.threads = state.range(0);
+    opts.validate_chunks = state.range(1);
+    for (auto _ : state) {
+        uint64_t count = 0;
+        scan_blocks(*reader, 0, IMAGE_BLOCKS, opts,
+                    [&](std::span<const CandidateRecord> candidates,
+                        uint64_t) { count += candidates.size(); });
+        benchmark::DoNotOptimize(count);
+    }
+    state.SetBytesProcessed(state.iterations() * IMAGE_BLOCKS * BLOCKSIZE);
+}
+
+//! Lists the data extents of a sparse image.
+void BM_DataExtents(benchmark::State &state) {
+    int fd = open(sparse_image_path().c_str(), O_RDONLY);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(data_extents(fd, 0, IMAGE_BLOCKS, BLOCKSIZE));
+    }
+    close(fd);
+    state.SetItemsProcessed(state.iterations() * IMAGE_BLOCKS);
+}
+
+//! Lists the free extents of the ext2 image from its block bitmap, as a
+//! scan of a filesystem does before reading.
+void BM_FreeExtents(benchmark::State &state) {
+    auto reader = make_reader(EXT2_READER);
+    if (!reader) {
+        state.SkipWithError("mke2fs or debugfs not available");
+        return;
+    }
+    uint64_t extents = 0;
+    for (auto _ : state) {
+        auto free = reader->scan_extents(0, IMAGE_BLOCKS);
+        extents = free.size();
+        benchmark::DoNotOptimize(free.data());
+    }
+    state.counters["extents"] = extents;
+    state.SetItemsProcessed(state.iterations() * IMAGE_BLOCKS);
+}
+
+void readers(benchmark::internal::Benchmark *b) {
+    b->ArgNames({"reader", "batch"});
+    for (int kind : {FILE_READER, MMAP_READER, MEMORY_READER, URING_READER,
+                     EXT2_READER}) {
+        for (int batch : {1, 64, 1024}) {
+            b->Args({kind, batch});
+        }
+    }
+}
+
+} // namespace
+
+BENCHMARK(BM_ViewBlocks)->Apply(readers);
+BENCHMARK(BM_StreamBlocks)->Apply(readers)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_ScanBlocks)
+    ->ArgNames({"threads", "validate"})
+    ->Args({1, 0})
+    ->Args({4, 0})
+    ->Args({1, 1})
+    ->Args({4, 1})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+BENCHMARK(BM_DataExtents);
+BENCHMARK(BM_FreeExtents);
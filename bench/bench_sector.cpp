@@ -0,0 +1,133 @@
+#include <cstdint>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "BlockReader.hpp"
+#include "chunk_validate.hpp"
+#include "corpus.hpp"
+#include "sector.hpp"
+
+using namespace mcarve;
+
+namespace {
+
+using namespace mcarve::bench;
+
+void BM_SeparateClassifiers(benchmark::State &state) {
+    auto corpus = make_corpus(static_cast<Corpus>(state.range(0)));
+    std::size_t i = 0;
+    for (auto _ : state) {
+        const auto &block = corpus[i++ % corpus.size()];
+        benchmark::DoNotOptimize(has_timestamps(block, MIN_TIME, MAX_TIME));
+        benchmark::DoNotOptimize(has_offsets(block));
+        benchmark::DoNotOptimize(has_encoded_chunk(block));
+    }
+    state.SetBytesProcessed(state.iterations() * BLOCKSIZE);
+}
+
+void BM_ClassifySector(benchmark::State &state) {
+    auto corpus = make_corpus(static_cast<Corpus>(state.range(0)));
+    std::size_t i = 0;
+    for (auto _ : state) {
+        const auto &block = corpus[i++ % corpus.size()];
+        benchmark::DoNotOptimize(classify_sector(block, MIN_TIME, MAX_TIME));
+    }
+    state.SetBytesProcessed(state.iterations() * BLOCKSIZE);
+}
+
+void BM_HasOffsets(benchmark::State &state) {
+    auto corpus = make_corpus(static_cast<Corpus>(state.range(0)));
+    std::size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(has_offsets(corpus[i++ % corpus.size()]));
+    }
+    state.SetBytesProcessed(state.iterations() * BLOCKSIZE);
+}
+
+void BM_HasTimestamps(benchmark::State &state) {
+    auto corpus = make_corpus(static_cast<Corpus>(state.range(0)));
+    std::size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(
+            has_timestamps(corpus[i++ % corpus.size()], MIN_TIME, MAX_TIME));
+    }
+    state.SetBytesProcessed(state.iterations() * BLOCKSIZE);
+}
+
+void BM_HasEncodedChunk(benchmark::State &state) {
+    auto corpus = make_corpus(static_cast<Corpus>(state.range(0)));
+    std::size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(
+            has_encoded_chunk(corpus[i++ % corpus.size()]));
+    }
+    state.SetBytesProcessed(state.iterations() * BLOCKSIZE);
+}
+
+void BM_IsMostlyZero(benchmark::State &state) {
+    auto corpus = make_corpus(static_cast<Corpus>(state.range(0)));
+    std::size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(is_mostly_zero(corpus[i++ % corpus.size()]));
+    }
+    state.SetBytesProcessed(state.iterations() * BLOCKSIZE);
+}
+
+void BM_IsAllZero(benchmark::State &state) {
+    auto corpus = make_corpus(static_cast<Corpus>(state.range(0)));
+    std::size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(is_all_zero(corpus[i++ % corpus.size()]));
+    }
+    state.SetBytesProcessed(state.iterations() * BLOCKSIZE);
+}
+
+void BM_CountNonzeroWords(benchmark::State &state) {
+    auto corpus = make_corpus(static_cast<Corpus>(state.range(0)));
+    std::size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(
+            count_nonzero_words(corpus[i++ % corpus.size()]));
+    }
+    state.SetBytesProcessed(state.iterations() * BLOCKSIZE);
+}
+
+void BM_ValidateChunk(benchmark::State &state) {
+    auto corpus = make_corpus(static_cast<Corpus>(state.range(0)));
+    const bool want_tags = state.range(1);
+    ChunkValidator validator;
+    ChunkTags tags;
+    std::size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(validator.validate(
+            corpus[i++ % corpus.size()], want_tags ? &tags : nullptr));
+    }
+    state.SetBytesProcessed(state.iterations() * BLOCKSIZE);
+}
+
+void corpora(benchmark::internal::Benchmark *b) {
+    b->ArgName("corpus");
+    for (int kind : ALL_CORPORA) {
+        b->Arg(kind);
+    }
+}
+
+} // namespace
+
+BENCHMARK(BM_SeparateClassifiers)->Apply(corpora);
+BENCHMARK(BM_ClassifySector)->Apply(corpora);
+// Dense region headers, with all 1024 chunks present, are the worst case.
+BENCHMARK(BM_HasOffsets)->ArgName("corpus")->Arg(OFFSETS)->Arg(ZERO);
+BENCHMARK(BM_HasTimestamps)->Apply(corpora);
+BENCHMARK(BM_HasEncodedChunk)->Apply(corpora);
+BENCHMARK(BM_IsMostlyZero)->Apply(corpora);
+BENCHMARK(BM_IsAllZero)->Apply(corpora);
+BENCHMARK(BM_CountNonzeroWords)->Apply(corpora);
+// Real chunks are proven NBT within the first few hundred bytes, random data
+// after a couple of bytes; the tags take more inflating.
+BENCHMARK(BM_ValidateChunk)
+    ->ArgNames({"corpus", "tags"})
+    ->Args({ZLIB_CHUNK, 0})
+    ->Args({ZLIB_CHUNK, 1})
+    ->Args({CHUNK, 0});
@@ -0,0 +1,105 @@
+#ifndef BENCH_CORPUS_H_
+#define BENCH_CORPUS_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include <zlib.h>
+
+#include "BlockReader.hpp"
+#include "synthetic.hpp"
+
+namespace mcarve::bench {
+
+constexpr uint32_t MIN_TIME = 1199145600; // 2008-01-01
+constexpr uint32_t MAX_TIME = 1767225600; // 2026-01-01
+constexpr int CORPUS_BLOCKS = 256;
+
+//! Kinds of blocks found on a disk with Minecraft worlds on it.
+enum Corpus {
+    RANDOM,     //!< Compressed or encrypted data of other files.
+    ZERO,       //!< Never written or trimmed free space.
+    OFFSETS,    //!< Dense region file offset tables.
+    TIMESTAMPS, //!< Region file timestamp tables.
+    CHUNK,      //!< A chunk header followed by random data.
+    ZLIB_CHUNK, //!< The first block of a real zlib-compressed chunk.
+    NBT,        //!< Uncompressed NBT, like level.dat or .dat player files.
+};
+
+inline constexpr Corpus ALL_CORPORA[] = {
+    RANDOM, ZERO, OFFSETS, TIMESTAMPS, CHUNK, ZLIB_CHUNK, NBT};
+
+inline void put_be32(unsigned char *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+inline BlockBuffer make_block(Corpus kind, std::mt19937 &rng) {
+    BlockBuffer block{};
+    switch (kind) {
+    case RANDOM:
+        for (auto &c : block) {
+            c = rng();
+        }
+        break;
+    case ZERO:
+        break;
+    case OFFSETS: {
+        uint32_t offset = 2;
+        for (int i = 0; i < 1024; ++i) {
+            uint32_t length = 1 + rng() % 3;
+            put_be32(&block[4 * i], offset << 8 | length);
+            offset += length;
+        }
+        break;
+    }
+    case TIMESTAMPS:
+        for (int i = 0; i < 1024; ++i) {
+            put_be32(&block[4 * i], MIN_TIME + rng() % (MAX_TIME - MIN_TIME));
+        }
+        break;
+    case CHUNK:
+        for (auto &c : block) {
+            c = rng();
+        }
+        put_be32(&block[0], 1 + rng() % 8000);
+        block[4] = 0x02;
+        block[5] = 0x78;
+        block[6] = 0x9c;
+        break;
+    case ZLIB_CHUNK: {
+        auto data = encode_chunk(
+            synthetic_chunk(rng, rng() % 1024, rng() % 1024),
+            Z_DEFAULT_COMPRESSION);
+        memcpy(block.data(), data.data(),
+               std::min<std::size_t>(data.size(), BLOCKSIZE));
+        break;
+    }
+    case NBT: {
+        auto data = synthetic_chunk(rng, rng() % 1024, rng() % 1024);
+        memcpy(block.data(), data.data(),
+               std::min<std::size_t>(data.size(), BLOCKSIZE));
+        break;
+    }
+    }
+    return block;
+}
+
+inline std::vector<BlockBuffer> make_corpus(Corpus kind) {
+    std::mt19937 rng(kind);
+    std::vector<BlockBuffer> blocks;
+    blocks.reserve(CORPUS_BLOCKS);
+    for (int i = 0; i < CORPUS_BLOCKS; ++i) {
+        blocks.push_back(make_block(kind, rng));
+    }
+    return blocks;
+}
+
+} // namespace mcarve::bench
+
+#endif // BENCH_CORPUS_H_
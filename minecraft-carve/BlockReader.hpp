@@ -1,17 +1,30 @@
 #ifndef BLOCKREADER_H_
 #define BLOCKREADER_H_
 
+#include <algorithm>
 #include <array>
 #include <cstdint>
-#include <fstream>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <span>
 #include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
 
-// for POSIX mmap
+// for POSIX pread and mmap
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <unistd.h>
 
+#ifdef MCARVE_HAVE_LIBURING
+#include <liburing.h>
+#endif
+
 #include "ext2filesystem.hpp"
+#include "extent.hpp"
 
 namespace mcarve {
 
@@ -26,6 +39,55 @@ class BlockReader {
     //! Reads the block of the given index into a provided buffer.
     virtual void read_block(uint64_t blknum, BlockBuffer &buf) = 0;
 
+    //! Reads `count` consecutive blocks starting at `first` into a buffer of
+    //! at least count * BLOCKSIZE bytes.  Readers override this to move the
+    //! whole run in as few system calls as possible.
+    virtual void read_blocks(uint64_t first, uint64_t count,
+                             std::span<unsigned char> buf) {
+        check_run_buffer(count, buf);
+        BlockBuffer block;
+        for (uint64_t i = 0; i < count; ++i) {
+            read_block(first + i, block);
+            memcpy(buf.data() + i * BLOCKSIZE, block.data(), BLOCKSIZE);
+        }
+    }
+
+    //! Returns a view of `count` consecutive blocks starting at `first`.
+    //! Readers that hold the image in memory return a view straight into
+    //! it.  Others read the blocks into `scratch` and return a view of that.
+    //! The view is valid until the next use of `scratch` or of the reader.
+    virtual std::span<const unsigned char>
+    view_blocks(uint64_t first, uint64_t count,
+                std::span<unsigned char> scratch) {
+        read_blocks(first, count, scratch);
+        return scratch.first(count * BLOCKSIZE);
+    }
+
+    //! Returns a view of a single block, as view_blocks().
+    std::span<const unsigned char> view_block(uint64_t blknum,
+                                              BlockBuffer &scratch) {
+        return view_blocks(blknum, 1, scratch);
+    }
+
+    //! Receives a run of blocks and the number of its first block.
+    using BlockVisitor =
+        std::function<void(uint64_t, std::span<const unsigned char>)>;
+
+    //! Passes `count` blocks starting at `first` to visit(), in order and at
+    //! most `batch` blocks at a time.  Readers that can overlap I/O with the
+    //! caller's work override this to keep reads in flight during visit().
+    //! visit() may read other blocks from the reader, e.g. those that follow
+    //! the run it was given.
+    virtual void stream_blocks(uint64_t first, uint64_t count, uint64_t batch,
+                               const BlockVisitor &visit) {
+        batch = std::max<uint64_t>(1, std::min(batch, count));
+        std::vector<unsigned char> scratch(batch * BLOCKSIZE);
+        for (uint64_t done = 0; done < count; done += batch) {
+            auto n = std::min(batch, count - done);
+            visit(first + done, view_blocks(first + done, n, scratch));
+        }
+    }
+
     //! Returns the first valid block index.
     virtual uint64_t first_blknum() const = 0;
 
@@ -35,6 +97,32 @@ class BlockReader {
     //! In the context of filesystem data, indicates whether a block is marked
     //! as being used Otherwise, returns false.
     virtual bool is_allocated(uint64_t blknum) { return false; }
+
+    //! Returns the sorted extents within [first, last) that are worth
+    //! scanning.  For filesystem data these are the unallocated blocks; for
+    //! image files the blocks that are not holes; otherwise the whole range.
+    virtual std::vector<BlockExtent> scan_extents(uint64_t first,
+                                                  uint64_t last) {
+        first = std::max(first, first_blknum());
+        last = std::min(last, blocks_count());
+        if (first >= last) {
+            return {};
+        }
+        return {{first, last - first}};
+    }
+
+    //! Indicates whether read_block() and read_blocks() may be called from
+    //! several threads at once.
+    virtual bool concurrent_reads() const { return false; }
+
+  protected:
+    static void check_run_buffer(uint64_t count,
+                                 std::span<unsigned char> buf) {
+        if (buf.size() < count * BLOCKSIZE) {
+            throw std::runtime_error("Buffer too small for " +
+                                     std::to_string(count) + " blocks");
+        }
+    }
 };
 
 //! Reader of 4kB data blocks from an ext2 filesystem.
@@ -51,6 +139,18 @@ class Ext2BlockReader : public BlockReader {
         e2fs.read_block(blknum, buf.data(), 1);
     }
 
+    void read_blocks(uint64_t first, uint64_t count,
+                     std::span<unsigned char> buf) override {
+        check_run_buffer(count, buf);
+        // io_channel_read_blk64 takes an int block count.
+        constexpr uint64_t max_run = 1 << 16;
+        for (uint64_t done = 0; done < count; done += max_run) {
+            auto run = std::min(max_run, count - done);
+            e2fs.read_block(first + done, buf.data() + done * BLOCKSIZE,
+                            static_cast<unsigned>(run));
+        }
+    }
+
     uint64_t first_blknum() const override { return e2fs.first_data_block(); }
 
     uint64_t blocks_count() const override { return e2fs.blocks_count(); }
@@ -59,6 +159,11 @@ class Ext2BlockReader : public BlockReader {
         return e2fs.block_is_used(blknum);
     }
 
+    std::vector<BlockExtent> scan_extents(uint64_t first,
+                                          uint64_t last) override {
+        return e2fs.free_extents(first, last);
+    }
+
   private:
     Ext2Filesystem e2fs;
 };
@@ -66,34 +171,62 @@ class Ext2BlockReader : public BlockReader {
 //! Reads 4k data blocks from any old file.
 class FileBlockReader : public BlockReader {
   private:
-    std::ifstream file;
+    int fd;
     uint64_t totalBlocks;
 
   public:
     FileBlockReader(const std::string &filename) {
-        file.open(filename, std::ios::binary);
-        if (!file.is_open()) {
+        fd = open(filename.c_str(), O_RDONLY);
+        if (fd == -1) {
             throw std::runtime_error("Failed to open file: " + filename);
-        } else {
-            file.seekg(0, std::ios::end);
-            totalBlocks = file.tellg() / BLOCKSIZE;
-            file.seekg(0, std::ios::beg);
+        }
+        totalBlocks = lseek(fd, 0, SEEK_END) / BLOCKSIZE;
+    }
+
+    ~FileBlockReader() {
+        if (fd != -1) {
+            close(fd);
         }
     }
 
     void read_block(uint64_t blknum, BlockBuffer &buf) override {
-        if (blknum >= totalBlocks) {
+        read_blocks(blknum, 1, buf);
+    }
+
+    void read_blocks(uint64_t first, uint64_t count,
+                     std::span<unsigned char> buf) override {
+        check_run_buffer(count, buf);
+        if (first >= totalBlocks || count > totalBlocks - first) {
             throw std::runtime_error("Block number out of range: " +
-                                     std::to_string(blknum));
+                                     std::to_string(first + count - 1));
         }
 
-        file.seekg(blknum * BLOCKSIZE);
-        file.read(reinterpret_cast<char *>(buf.data()), BLOCKSIZE);
+        unsigned char *dst = buf.data();
+        uint64_t remaining = count * BLOCKSIZE;
+        off_t pos = first * BLOCKSIZE;
+        while (remaining > 0) {
+            ssize_t n = pread(fd, dst, remaining, pos);
+            if (n <= 0) {
+                throw std::runtime_error("Failed to read block " +
+                                         std::to_string(pos / BLOCKSIZE));
+            }
+            dst += n;
+            pos += n;
+            remaining -= n;
+        }
     }
 
     uint64_t first_blknum() const override { return 0; }
 
     uint64_t blocks_count() const override { return totalBlocks; }
+
+    std::vector<BlockExtent> scan_extents(uint64_t first,
+                                          uint64_t last) override {
+        return data_extents(fd, std::max(first, first_blknum()),
+                            std::min(last, totalBlocks), BLOCKSIZE);
+    }
+
+    bool concurrent_reads() const override { return true; }
 };
 
 //! Reads 4k data blocks from any old file using memory mapped reads.
@@ -119,6 +252,7 @@ class MmapBlockReader : public BlockReader {
             close(fd);
             throw std::runtime_error("Failed to mmap file");
         }
+        madvise(fileData, fileSize, MADV_SEQUENTIAL);
     }
 
     ~MmapBlockReader() {
@@ -139,10 +273,347 @@ class MmapBlockReader : public BlockReader {
         memcpy(buf.data(), fileData + blknum * BLOCKSIZE, BLOCKSIZE);
     }
 
+    void read_blocks(uint64_t first, uint64_t count,
+                     std::span<unsigned char> buf) override {
+        check_run_buffer(count, buf);
+        if (first >= totalBlocks || count > totalBlocks - first) {
+            throw std::out_of_range("Block number out of range: " +
+                                    std::to_string(first + count - 1));
+        }
+
+        memcpy(buf.data(), fileData + first * BLOCKSIZE, count * BLOCKSIZE);
+    }
+
+    std::span<const unsigned char>
+    view_blocks(uint64_t first, uint64_t count,
+                std::span<unsigned char> scratch) override {
+        if (first >= totalBlocks || count > totalBlocks - first) {
+            throw std::out_of_range("Block number out of range: " +
+                                    std::to_string(first + count - 1));
+        }
+        return {fileData + first * BLOCKSIZE, count * BLOCKSIZE};
+    }
+
     uint64_t first_blknum() const override { return 0; }
 
     uint64_t blocks_count() const override { return totalBlocks; }
+
+    std::vector<BlockExtent> scan_extents(uint64_t first,
+                                          uint64_t last) override {
+        return data_extents(fd, std::max(first, first_blknum()),
+                            std::min(last, totalBlocks), BLOCKSIZE);
+    }
+
+    bool concurrent_reads() const override { return true; }
+};
+
+//! Serves 4k data blocks from an image held in memory.
+class MemoryBlockReader : public BlockReader {
+  private:
+    std::vector<unsigned char> image;
+    uint64_t totalBlocks;
+
+  public:
+    MemoryBlockReader(std::vector<unsigned char> data)
+        : image(std::move(data)), totalBlocks(image.size() / BLOCKSIZE) {}
+
+    void read_block(uint64_t blknum, BlockBuffer &buf) override {
+        read_blocks(blknum, 1, buf);
+    }
+
+    void read_blocks(uint64_t first, uint64_t count,
+                     std::span<unsigned char> buf) override {
+        check_run_buffer(count, buf);
+        auto view = view_blocks(first, count, buf);
+        memcpy(buf.data(), view.data(), view.size());
+    }
+
+    std::span<const unsigned char>
+    view_blocks(uint64_t first, uint64_t count,
+                std::span<unsigned char> scratch) override {
+        if (first >= totalBlocks || count > totalBlocks - first) {
+            throw std::out_of_range("Block number out of range: " +
+                                    std::to_string(first + count - 1));
+        }
+        return {image.data() + first * BLOCKSIZE, count * BLOCKSIZE};
+    }
+
+    uint64_t first_blknum() const override { return 0; }
+
+    uint64_t blocks_count() const override { return totalBlocks; }
+
+    bool concurrent_reads() const override { return true; }
+};
+
+//! Opens an image with the reader best suited to it: an ext2/3/4 filesystem
+//! is read through libext2fs so that its free space is known, and anything
+//! else is memory mapped.
+inline std::unique_ptr<BlockReader> open_image(const std::string &filename) {
+    if (IdentifyExt2FS(filename)) {
+        return std::make_unique<Ext2BlockReader>(filename);
+    }
+    return std::make_unique<MmapBlockReader>(filename);
+}
+
+#ifdef MCARVE_HAVE_LIBURING
+//! Reads 4k data blocks from any old file, keeping a queue of large reads in
+//! flight with io_uring.
+//!
+//! stream_blocks() is the fast path: it issues up to `queue_depth` reads of
+//! `request_blocks` each, and hands every completed buffer to the visitor in
+//! block order while the later reads are still in flight.  No extra threads
+//! are involved.  Reads made by the visitor go through a spare buffer,
+//! alongside the stream.
+class IoUringBlockReader : public BlockReader {
+  public:
+    struct Options {
+        //! Number of reads kept in flight.
+        unsigned queue_depth = 32;
+        //! Number of blocks per read.
+        uint64_t request_blocks = 64;
+        //! Open the file with O_DIRECT, bypassing the page cache.
+        bool direct = false;
+        //! Register the read buffers with the kernel.  Falls back to plain
+        //! buffers if registration fails, e.g. on a low RLIMIT_MEMLOCK.
+        bool register_buffers = false;
+    };
+
+  private:
+    struct Slot {
+        unsigned char *buf;
+        uint64_t first;
+        uint64_t count;
+        uint64_t bytes_done;
+        bool ready;
+    };
+
+    int fd;
+    uint64_t totalBlocks;
+    Options opts;
+    io_uring ring;
+    std::vector<Slot> slots;
+    bool registered = false;
+    unsigned inflight = 0;
+    //! Set during stream_blocks(), whose slots are then in use.
+    bool streaming = false;
+
+    void submit(unsigned index) {
+        Slot &slot = slots[index];
+        io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+        if (sqe == nullptr) {
+            throw std::runtime_error("io_uring submission queue is full");
+        }
+        unsigned char *dst = slot.buf + slot.bytes_done;
+        unsigned len = slot.count * BLOCKSIZE - slot.bytes_done;
+        uint64_t pos = slot.first * BLOCKSIZE + slot.bytes_done;
+        if (registered) {
+            io_uring_prep_read_fixed(sqe, fd, dst, len, pos, index);
+        } else {
+            io_uring_prep_read(sqe, fd, dst, len, pos);
+        }
+        io_uring_sqe_set_data(sqe, &slot);
+        ++inflight;
+    }
+
+    //! Reaps one completion, resubmitting the remainder of a short read.
+    void reap() {
+        io_uring_cqe *cqe;
+        int err = io_uring_wait_cqe(&ring, &cqe);
+        if (err < 0) {
+            throw std::runtime_error("io_uring_wait_cqe failed: " +
+                                     std::string(strerror(-err)));
+        }
+        Slot &slot = *static_cast<Slot *>(io_uring_cqe_get_data(cqe));
+        int res = cqe->res;
+        io_uring_cqe_seen(&ring, cqe);
+        --inflight;
+        if (res <= 0) {
+            throw std::runtime_error(
+                "Failed to read block " + std::to_string(slot.first) + ": " +
+                (res < 0 ? strerror(-res) : "unexpected end of file"));
+        }
+        slot.bytes_done += res;
+        if (slot.bytes_done < slot.count * BLOCKSIZE) {
+            submit(&slot - slots.data());
+            io_uring_submit(&ring);
+        } else {
+            slot.ready = true;
+        }
+    }
+
+    //! Waits for every outstanding read, so no buffer is left in use.
+    void drain() noexcept {
+        while (inflight > 0) {
+            io_uring_cqe *cqe;
+            if (io_uring_wait_cqe(&ring, &cqe) < 0) {
+                break;
+            }
+            io_uring_cqe_seen(&ring, cqe);
+            --inflight;
+        }
+    }
+
+    void release() noexcept {
+        drain();
+        if (registered) {
+            io_uring_unregister_buffers(&ring);
+        }
+        io_uring_queue_exit(&ring);
+        for (auto &slot : slots) {
+            std::free(slot.buf);
+        }
+        slots.clear();
+        close(fd);
+    }
+
+  public:
+    IoUringBlockReader(const std::string &filename, Options options)
+        : opts(options) {
+        opts.queue_depth = std::max(1u, opts.queue_depth);
+        opts.request_blocks = std::max<uint64_t>(1, opts.request_blocks);
+
+        fd = open(filename.c_str(), O_RDONLY | (opts.direct ? O_DIRECT : 0));
+        if (fd == -1) {
+            throw std::runtime_error("Failed to open file: " + filename);
+        }
+        totalBlocks = lseek(fd, 0, SEEK_END) / BLOCKSIZE;
+
+        int err = io_uring_queue_init(opts.queue_depth, &ring, 0);
+        if (err < 0) {
+            close(fd);
+            throw std::runtime_error("io_uring_queue_init failed: " +
+                                     std::string(strerror(-err)));
+        }
+
+        // O_DIRECT needs block-aligned buffers.  The last slot is the spare
+        // one that read_blocks() uses during stream_blocks().
+        const std::size_t slot_bytes = opts.request_blocks * BLOCKSIZE;
+        std::vector<iovec> iovs;
+        for (unsigned i = 0; i <= opts.queue_depth; ++i) {
+            auto *buf = static_cast<unsigned char *>(
+                std::aligned_alloc(BLOCKSIZE, slot_bytes));
+            if (buf == nullptr) {
+                release();
+                throw std::bad_alloc();
+            }
+            slots.push_back({buf, 0, 0, 0, false});
+            iovs.push_back({buf, slot_bytes});
+        }
+        if (opts.register_buffers) {
+            registered =
+                io_uring_register_buffers(&ring, iovs.data(), iovs.size()) ==
+                0;
+        }
+    }
+
+    IoUringBlockReader(const std::string &filename)
+        : IoUringBlockReader(filename, Options{}) {}
+
+    ~IoUringBlockReader() { release(); }
+
+    IoUringBlockReader(const IoUringBlockReader &) = delete;
+    IoUringBlockReader &operator=(const IoUringBlockReader &) = delete;
+
+    void read_block(uint64_t blknum, BlockBuffer &buf) override {
+        read_blocks(blknum, 1, buf);
+    }
+
+    void read_blocks(uint64_t first, uint64_t count,
+                     std::span<unsigned char> buf) override {
+        check_run_buffer(count, buf);
+        if (!streaming) {
+            stream_blocks(
+                first, count, opts.request_blocks,
+                [&](uint64_t blk, std::span<const unsigned char> data) {
+                    memcpy(buf.data() + (blk - first) * BLOCKSIZE,
+                           data.data(), data.size());
+                });
+            return;
+        }
+        if (first >= totalBlocks || count > totalBlocks - first) {
+            throw std::out_of_range("Block number out of range: " +
+                                    std::to_string(first + count - 1));
+        }
+        // The stream's reads stay in flight and are reaped along the way.
+        const unsigned index = opts.queue_depth;
+        Slot &slot = slots[index];
+        for (uint64_t done = 0; done < count; done += opts.request_blocks) {
+            slot.first = first + done;
+            slot.count = std::min(opts.request_blocks, count - done);
+            slot.bytes_done = 0;
+            slot.ready = false;
+            submit(index);
+            io_uring_submit(&ring);
+            while (!slot.ready) {
+                reap();
+            }
+            memcpy(buf.data() + done * BLOCKSIZE, slot.buf,
+                   slot.count * BLOCKSIZE);
+        }
+    }
+
+    void stream_blocks(uint64_t first, uint64_t count, uint64_t batch,
+                       const BlockVisitor &visit) override {
+        if (first >= totalBlocks || count > totalBlocks - first) {
+            throw std::out_of_range("Block number out of range: " +
+                                    std::to_string(first + count - 1));
+        }
+        if (streaming) {
+            throw std::logic_error("stream_blocks() is not reentrant");
+        }
+        const uint64_t seg =
+            std::max<uint64_t>(1, std::min(batch, opts.request_blocks));
+        const uint64_t segments = (count + seg - 1) / seg;
+        const unsigned depth = opts.queue_depth;
+        uint64_t next_submit = 0;
+
+        auto submit_segment = [&](uint64_t n) {
+            unsigned index = n % depth;
+            Slot &slot = slots[index];
+            slot.first = first + n * seg;
+            slot.count = std::min(seg, count - n * seg);
+            slot.bytes_done = 0;
+            slot.ready = false;
+            submit(index);
+        };
+
+        streaming = true;
+        try {
+            while (next_submit < segments && next_submit < depth) {
+                submit_segment(next_submit++);
+            }
+            io_uring_submit(&ring);
+
+            for (uint64_t n = 0; n < segments; ++n) {
+                Slot &slot = slots[n % depth];
+                while (!slot.ready) {
+                    reap();
+                }
+                visit(slot.first, {slot.buf, slot.count * BLOCKSIZE});
+                if (next_submit < segments) {
+                    submit_segment(next_submit++);
+                    io_uring_submit(&ring);
+                }
+            }
+        } catch (...) {
+            streaming = false;
+            drain();
+            throw;
+        }
+        streaming = false;
+    }
+
+    uint64_t first_blknum() const override { return 0; }
+
+    uint64_t blocks_count() const override { return totalBlocks; }
+
+    std::vector<BlockExtent> scan_extents(uint64_t first,
+                                          uint64_t last) override {
+        return data_extents(fd, std::max(first, first_blknum()),
+                            std::min(last, totalBlocks), BLOCKSIZE);
+    }
 };
+#endif // MCARVE_HAVE_LIBURING
 
 } // namespace mcarve
 
@@ -0,0 +1,215 @@
+// candidates.cpp
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "candidates.hpp"
+#include "sector.hpp"
+
+namespace mcarve {
+
+namespace {
+
+// Records buffered by CandidateIndexWriter before each write.
+constexpr std::size_t WRITE_BUFFER_RECORDS = 1 << 15;
+
+bool valid_header(const CandidateIndexHeader &header) {
+    return memcmp(header.magic, CANDIDATE_INDEX_MAGIC,
+                  sizeof(CANDIDATE_INDEX_MAGIC)) == 0 &&
+           header.version == CANDIDATE_INDEX_VERSION &&
+           header.record_size == sizeof(CandidateRecord);
+}
+
+} // namespace
+
+CandidateIndexWriter::CandidateIndexWriter(const std::string &filename,
+                                           uint32_t min_time,
+                                           uint32_t max_time)
+    : m_offset(sizeof(CandidateIndexHeader)), m_header{} {
+    memcpy(m_header.magic, CANDIDATE_INDEX_MAGIC, sizeof(m_header.magic));
+    m_header.version = CANDIDATE_INDEX_VERSION;
+    m_header.record_size = sizeof(CandidateRecord);
+    m_header.min_time = min_time;
+    m_header.max_time = max_time;
+
+    m_fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (m_fd == -1) {
+        throw std::runtime_error("Failed to open candidate index: " +
+                                 filename);
+    }
+    m_buffer.reserve(WRITE_BUFFER_RECORDS);
+    write_at(&m_header, sizeof(m_header), 0);
+}
+
+CandidateIndexWriter::CandidateIndexWriter(const std::string &filename,
+                                           uint64_t keep) {
+    m_fd = open(filename.c_str(), O_RDWR);
+    if (m_fd == -1) {
+        throw std::runtime_error("Failed to open candidate index: " +
+                                 filename);
+    }
+    m_offset = sizeof(CandidateIndexHeader) + keep * sizeof(CandidateRecord);
+    struct stat st;
+    if (pread(m_fd, &m_header, sizeof(m_header), 0) != sizeof(m_header) ||
+        !valid_header(m_header) || fstat(m_fd, &st) == -1 ||
+        static_cast<uint64_t>(st.st_size) < m_offset ||
+        ftruncate(m_fd, m_offset) == -1) {
+        ::close(m_fd);
+        throw std::runtime_error("Cannot resume candidate index: " +
+                                 filename);
+    }
+    m_header.record_count = keep;
+    // The index may have been closed before the scan that wrote it was
+    // done with its checkpoint; it is unfinished again until close().
+    m_header.flags &= ~CANDIDATE_INDEX_FINISHED;
+    try {
+        write_at(&m_header, sizeof(m_header), 0);
+    } catch (...) {
+        ::close(m_fd);
+        throw;
+    }
+    m_buffer.reserve(WRITE_BUFFER_RECORDS);
+}
+
+CandidateIndexWriter::~CandidateIndexWriter() {
+    if (m_fd != -1) {
+        try {
+            close();
+        } catch (...) {
+        }
+    }
+}
+
+void CandidateIndexWriter::write_at(const void *data, std::size_t size,
+                                    uint64_t offset) {
+    auto *p = static_cast<const char *>(data);
+    while (size > 0) {
+        ssize_t n = pwrite(m_fd, p, size, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            throw std::runtime_error("Failed to write candidate index");
+        }
+        p += n;
+        size -= n;
+        offset += n;
+    }
+}
+
+void CandidateIndexWriter::append(std::span<const CandidateRecord> records) {
+    m_buffer.insert(m_buffer.end(), records.begin(), records.end());
+    m_header.record_count += records.size();
+    if (m_buffer.size() >= WRITE_BUFFER_RECORDS) {
+        flush();
+    }
+}
+
+void CandidateIndexWriter::flush() {
+    const std::size_t size = m_buffer.size() * sizeof(CandidateRecord);
+    write_at(m_buffer.data(), size, m_offset);
+    m_offset += size;
+    m_buffer.clear();
+}
+
+void CandidateIndexWriter::sync() {
+    if (fdatasync(m_fd) != 0) {
+        throw std::runtime_error("Failed to sync candidate index");
+    }
+}
+
+void CandidateIndexWriter::close() {
+    const int fd = m_fd;
+    try {
+        flush();
+        m_header.flags |= CANDIDATE_INDEX_FINISHED;
+        write_at(&m_header, sizeof(m_header), 0);
+    } catch (...) {
+        m_fd = -1;
+        ::close(fd);
+        throw;
+    }
+    m_fd = -1;
+    if (::close(fd) != 0) {
+        throw std::runtime_error("Failed to write candidate index");
+    }
+}
+
+CandidateIndex::CandidateIndex(const std::string &filename) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd == -1) {
+        throw std::runtime_error("Failed to open candidate index: " +
+                                 filename);
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 ||
+        st.st_size < static_cast<off_t>(sizeof(CandidateIndexHeader))) {
+        close(fd);
+        throw std::runtime_error("Not a candidate index: " + filename);
+    }
+    m_size = st.st_size;
+    m_data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (m_data == MAP_FAILED) {
+        throw std::runtime_error("Failed to mmap candidate index: " +
+                                 filename);
+    }
+
+    m_header = static_cast<const CandidateIndexHeader *>(m_data);
+    const uint64_t count = m_header->record_count;
+    if (!valid_header(*m_header) ||
+        count > (m_size - sizeof(CandidateIndexHeader)) /
+                    sizeof(CandidateRecord)) {
+        munmap(m_data, m_size);
+        throw std::runtime_error("Not a valid candidate index: " + filename);
+    }
+    m_records = {reinterpret_cast<const CandidateRecord *>(m_header + 1),
+                 count};
+}
+
+CandidateIndex::~CandidateIndex() { munmap(m_data, m_size); }
+
+const CandidateRecord *CandidateIndex::find(uint64_t blknum) const {
+    auto it = std::lower_bound(
+        m_records.begin(), m_records.end(), blknum,
+        [](const CandidateRecord &r, uint64_t b) { return r.blknum < b; });
+    if (it == m_records.end() || it->blknum != blknum) {
+        return nullptr;
+    }
+    return &*it;
+}
+
+void CandidateTextWriter::write(std::span<const CandidateRecord> records) {
+    for (const auto &rec : records) {
+        if (rec.types & SECTOR_TIMESTAMPS) {
+            finish();
+            m_out << rec.blknum << ": timestamps\n";
+        }
+        if (rec.types & SECTOR_OFFSETS) {
+            finish();
+            m_out << rec.blknum << ": offsets\n";
+        }
+        if (rec.types & SECTOR_CHUNK) {
+            if (m_chunk_header_count == 0) {
+                m_out << rec.blknum << ": chunk headers: ";
+            }
+            m_chunk_header_count++;
+        }
+    }
+}
+
+void CandidateTextWriter::finish() {
+    if (m_chunk_header_count > 0) {
+        m_out << "[" << m_chunk_header_count << "]\n";
+        m_chunk_header_count = 0;
+    }
+}
+
+} // namespace mcarve
@@ -0,0 +1,134 @@
+#ifndef CANDIDATES_H_
+#define CANDIDATES_H_
+
+#include <bit>
+#include <cstdint>
+#include <ostream>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace mcarve {
+
+static_assert(std::endian::native == std::endian::little,
+              "The candidate index is stored in little-endian byte order");
+
+//! One candidate block found in pass 1, as stored in a candidate index.
+struct CandidateRecord {
+    uint64_t blknum;
+    uint8_t types; //!< SectorType flags
+    uint8_t reserved[3];
+    //! Length word of an encoded chunk (SECTOR_CHUNK), else zero.
+    uint32_t chunk_length;
+    //! presence_hash() of the table (SECTOR_OFFSETS, SECTOR_TIMESTAMPS),
+    //! else zero.
+    uint64_t presence_hash;
+    //! Chunk coordinates (SECTOR_CHUNK_COORDS), else zero.
+    int32_t x_pos;
+    int32_t z_pos;
+};
+static_assert(sizeof(CandidateRecord) == 32);
+
+//! Fixed-size header at the start of a candidate index file.  It is
+//! followed by record_count CandidateRecords sorted by block number.
+struct CandidateIndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t record_count;
+    //! Timestamp range accepted by the scan that produced the index.
+    uint32_t min_time;
+    uint32_t max_time;
+    //! CandidateIndexFlags.
+    uint32_t flags;
+    uint8_t reserved[28];
+};
+static_assert(sizeof(CandidateIndexHeader) == 64);
+
+enum CandidateIndexFlags : uint32_t {
+    //! Set by CandidateIndexWriter::close().  An index without it was left
+    //! unfinished, and its record_count may fall short of its records.
+    CANDIDATE_INDEX_FINISHED = 1 << 0,
+};
+
+inline constexpr char CANDIDATE_INDEX_MAGIC[8] = {'M', 'C', 'C', 'A',
+                                                  'N', 'D', 'X', '\0'};
+inline constexpr uint32_t CANDIDATE_INDEX_VERSION = 1;
+
+//! Writes a candidate index file.  Records must be appended in block order.
+class CandidateIndexWriter {
+  public:
+    //! Creates the index file, replacing any file of that name.
+    CandidateIndexWriter(const std::string &filename, uint32_t min_time,
+                         uint32_t max_time);
+    //! Reopens an index left unfinished by an interrupted scan.  Its first
+    //! `keep` records are kept and any written after them are dropped.
+    CandidateIndexWriter(const std::string &filename, uint64_t keep);
+    ~CandidateIndexWriter();
+    CandidateIndexWriter(const CandidateIndexWriter &) = delete;
+    CandidateIndexWriter &operator=(const CandidateIndexWriter &) = delete;
+
+    void append(std::span<const CandidateRecord> records);
+    //! Hands the buffered records to the kernel.
+    void flush();
+    //! Waits until the records handed to the kernel are on disk.  Unlike the
+    //! other members, it may be called while another thread appends.
+    void sync();
+    //! Writes the final record count into the header, marks the index
+    //! finished and closes the file.
+    void close();
+
+    uint64_t record_count() const { return m_header.record_count; }
+    uint32_t min_time() const { return m_header.min_time; }
+    uint32_t max_time() const { return m_header.max_time; }
+
+  private:
+    void write_at(const void *data, std::size_t size, uint64_t offset);
+
+    int m_fd;
+    //! File offset of the first buffered record.
+    uint64_t m_offset;
+    std::vector<CandidateRecord> m_buffer;
+    CandidateIndexHeader m_header;
+};
+
+//! Read-only, memory-mapped view of a candidate index file.
+class CandidateIndex {
+  public:
+    CandidateIndex(const std::string &filename);
+    ~CandidateIndex();
+    CandidateIndex(const CandidateIndex &) = delete;
+    CandidateIndex &operator=(const CandidateIndex &) = delete;
+
+    const CandidateIndexHeader &header() const { return *m_header; }
+    std::span<const CandidateRecord> records() const { return m_records; }
+
+    //! Returns the record of the given block, or nullptr.
+    const CandidateRecord *find(uint64_t blknum) const;
+
+  private:
+    void *m_data;
+    std::size_t m_size;
+    const CandidateIndexHeader *m_header;
+    std::span<const CandidateRecord> m_records;
+};
+
+//! Prints candidates in the human-readable pass 1 format: one line per
+//! table, and one line per run of chunk headers with the run's length.
+class CandidateTextWriter {
+  public:
+    CandidateTextWriter(std::ostream &out) : m_out(out) {}
+    ~CandidateTextWriter() { finish(); }
+
+    void write(std::span<const CandidateRecord> records);
+    //! Ends a pending run of chunk headers.
+    void finish();
+
+  private:
+    std::ostream &m_out;
+    int m_chunk_header_count = 0;
+};
+
+} // namespace mcarve
+
+#endif // CANDIDATES_H_
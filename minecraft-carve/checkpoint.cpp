@@ -0,0 +1,136 @@
+// checkpoint.cpp
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "checkpoint.hpp"
+
+namespace mcarve {
+
+ScanCheckpoint make_checkpoint() {
+    ScanCheckpoint checkpoint{};
+    memcpy(checkpoint.magic, SCAN_CHECKPOINT_MAGIC, sizeof(checkpoint.magic));
+    checkpoint.version = SCAN_CHECKPOINT_VERSION;
+    return checkpoint;
+}
+
+uint64_t hash_ranges(std::span<const BlockExtent> ranges) {
+    uint64_t hash = 0xcbf29ce484222325;
+    for (const auto &range : ranges) {
+        for (uint64_t value : {range.start, range.length}) {
+            for (int i = 0; i < 8; ++i) {
+                hash ^= (value >> (8 * i)) & 0xff;
+                hash *= 0x100000001b3;
+            }
+        }
+    }
+    return hash;
+}
+
+void save_checkpoint(const std::string &filename,
+                     const ScanCheckpoint &checkpoint) {
+    const std::string temp = filename + ".tmp";
+    int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        throw std::runtime_error("Failed to create checkpoint: " + temp);
+    }
+    const bool ok =
+        write(fd, &checkpoint, sizeof(checkpoint)) == sizeof(checkpoint) &&
+        fsync(fd) == 0;
+    if (close(fd) != 0 || !ok ||
+        rename(temp.c_str(), filename.c_str()) != 0) {
+        throw std::runtime_error("Failed to write checkpoint: " + filename);
+    }
+}
+
+ScanCheckpoint load_checkpoint(const std::string &filename) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd == -1) {
+        throw std::runtime_error("Failed to open checkpoint: " + filename);
+    }
+    ScanCheckpoint checkpoint;
+    const bool ok =
+        read(fd, &checkpoint, sizeof(checkpoint)) == sizeof(checkpoint);
+    close(fd);
+    if (!ok ||
+        memcmp(checkpoint.magic, SCAN_CHECKPOINT_MAGIC,
+               sizeof(SCAN_CHECKPOINT_MAGIC)) != 0 ||
+        checkpoint.version != SCAN_CHECKPOINT_VERSION) {
+        throw std::runtime_error("Not a valid checkpoint: " + filename);
+    }
+    return checkpoint;
+}
+
+CheckpointWriter::CheckpointWriter(const std::string &filename,
+                                   CandidateIndexWriter &index)
+    : m_filename(filename), m_index(index) {
+    m_thread = std::thread([this] { run(); });
+}
+
+CheckpointWriter::~CheckpointWriter() { finish(); }
+
+bool CheckpointWriter::submit(const ScanCheckpoint &checkpoint) {
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        if (m_error) {
+            std::rethrow_exception(std::exchange(m_error, nullptr));
+        }
+        if (m_busy) {
+            return false;
+        }
+    }
+    m_index.flush();
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_pending = checkpoint;
+    m_busy = true;
+    m_cv.notify_all();
+    return true;
+}
+
+void CheckpointWriter::remove() {
+    finish();
+    unlink(m_filename.c_str());
+}
+
+void CheckpointWriter::run() {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    for (;;) {
+        m_cv.wait(lock, [&] { return m_pending || m_stop; });
+        if (!m_pending) {
+            return;
+        }
+        const ScanCheckpoint checkpoint = *m_pending;
+        m_pending.reset();
+        lock.unlock();
+        std::exception_ptr error;
+        try {
+            m_index.sync();
+            save_checkpoint(m_filename, checkpoint);
+        } catch (...) {
+            error = std::current_exception();
+        }
+        lock.lock();
+        if (error && !m_error) {
+            m_error = error;
+        }
+        m_busy = false;
+    }
+}
+
+void CheckpointWriter::finish() {
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_stop = true;
+        m_cv.notify_all();
+    }
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+} // namespace mcarve
@@ -0,0 +1,105 @@
+#ifndef CHECKPOINT_H_
+#define CHECKPOINT_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <thread>
+
+#include "candidates.hpp"
+#include "extent.hpp"
+
+namespace mcarve {
+
+//! Progress of a scan that writes a candidate index, saved so that an
+//! interrupted scan can be resumed.  The settings that decide which
+//! candidates are found are saved with it; a resumed scan must use them to
+//! write the same index as an uninterrupted one.
+struct ScanCheckpoint {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved0;
+    //! Every block of the scanned extents below this one is done.
+    uint64_t scanned_to;
+    //! Number of index records that cover those blocks.
+    uint64_t record_count;
+    //! The block range of the scan: the start of its first range and the
+    //! end of its last.
+    uint64_t first;
+    uint64_t last;
+    uint64_t shard_blocks;
+    uint32_t min_time;
+    uint32_t max_time;
+    uint8_t validate_chunks;
+    uint8_t reserved1[7];
+    //! hash_ranges() of the block ranges of the scan.
+    uint64_t ranges_hash;
+    uint8_t reserved[16];
+};
+static_assert(sizeof(ScanCheckpoint) == 96);
+
+inline constexpr char SCAN_CHECKPOINT_MAGIC[8] = {'M', 'C', 'C', 'K',
+                                                  'P', 'T', '\0', '\0'};
+inline constexpr uint32_t SCAN_CHECKPOINT_VERSION = 2;
+
+//! Returns a checkpoint with the magic and version filled in.
+ScanCheckpoint make_checkpoint();
+
+//! Hashes a list of block ranges to 64 bits (FNV-1a), to tell whether a
+//! resumed scan covers the same ranges.
+uint64_t hash_ranges(std::span<const BlockExtent> ranges);
+
+//! Replaces the checkpoint file atomically, so that a crash leaves either
+//! the old or the new checkpoint.
+void save_checkpoint(const std::string &filename,
+                     const ScanCheckpoint &checkpoint);
+
+ScanCheckpoint load_checkpoint(const std::string &filename);
+
+//! Saves checkpoints of a scan on a background thread, so that waiting for
+//! the disk does not hold up the scan.
+//!
+//! A checkpoint is only written once the index records it counts are on
+//! disk.  After a crash, the index can therefore be cut back to the
+//! checkpoint and the scan resumed from there.
+class CheckpointWriter {
+  public:
+    CheckpointWriter(const std::string &filename, CandidateIndexWriter &index);
+    ~CheckpointWriter();
+    CheckpointWriter(const CheckpointWriter &) = delete;
+    CheckpointWriter &operator=(const CheckpointWriter &) = delete;
+
+    //! Flushes the index and queues the checkpoint, whose record_count must
+    //! be the index's.  Returns false, doing nothing, while the previous
+    //! checkpoint is still being saved.  Errors of earlier saves are
+    //! rethrown here.
+    bool submit(const ScanCheckpoint &checkpoint);
+
+    //! Waits for a checkpoint being saved and stops the background thread.
+    //! It must be called before the index is closed.
+    void finish();
+
+    //! Deletes the checkpoint file, once the index is complete.
+    void remove();
+
+  private:
+    void run();
+
+    std::string m_filename;
+    CandidateIndexWriter &m_index;
+    std::mutex m_mtx;
+    std::condition_variable m_cv;
+    std::optional<ScanCheckpoint> m_pending;
+    bool m_busy = false;
+    bool m_stop = false;
+    std::exception_ptr m_error;
+    std::thread m_thread;
+};
+
+} // namespace mcarve
+
+#endif // CHECKPOINT_H_
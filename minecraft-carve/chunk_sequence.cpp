@@ -0,0 +1,78 @@
+// chunk_sequence.cpp
+
+#include <algorithm>
+
+#include "chunk_sequence.hpp"
+
+namespace mcarve {
+
+namespace {
+
+//! Packs the four 10-bit chunk indices of a sequence.
+uint64_t sequence_key(const ChunkSequence &sequence) {
+    uint64_t key = 0;
+    for (uint16_t index : sequence) {
+        key = key << 10 | (index & 0x3ff);
+    }
+    return key;
+}
+
+} // namespace
+
+void ChunkSequenceIndex::add_table(uint32_t table,
+                                   std::span<const uint32_t> offsets) {
+    // Present chunks as sector << 16 | index, so sorting puts them in file
+    // order.
+    std::vector<uint64_t> chunks;
+    for (std::size_t i = 0; i < offsets.size(); ++i) {
+        if ((offsets[i] & 0xff) != 0) {
+            chunks.push_back(uint64_t{offsets[i] >> 8} << 16 | i);
+        }
+    }
+    std::sort(chunks.begin(), chunks.end());
+    for (std::size_t i = 0; i + 4 <= chunks.size(); ++i) {
+        ChunkSequence sequence;
+        for (std::size_t k = 0; k < 4; ++k) {
+            sequence[k] = chunks[i + k] & 0xffff;
+        }
+        m_entries.push_back({sequence_key(sequence),
+                             {table, static_cast<uint32_t>(chunks[i] >> 16)}});
+    }
+}
+
+void ChunkSequenceIndex::build() {
+    std::stable_sort(m_entries.begin(), m_entries.end(),
+                     [](const Entry &a, const Entry &b) {
+                         return a.key < b.key;
+                     });
+    m_hits.clear();
+    m_hits.reserve(m_entries.size());
+    m_index.clear();
+    m_index.reserve(m_entries.size());
+    m_collisions = 0;
+    for (auto it = m_entries.begin(); it != m_entries.end();) {
+        Range range{static_cast<uint32_t>(m_hits.size()), 0};
+        const uint64_t key = it->key;
+        for (; it != m_entries.end() && it->key == key; ++it) {
+            m_hits.push_back(it->hit);
+            ++range.count;
+        }
+        if (range.count > 1) {
+            ++m_collisions;
+        }
+        m_index.emplace(key, range);
+    }
+    m_entries.clear();
+    m_entries.shrink_to_fit();
+}
+
+std::span<const SequenceHit>
+ChunkSequenceIndex::find(const ChunkSequence &sequence) const {
+    auto it = m_index.find(sequence_key(sequence));
+    if (it == m_index.end()) {
+        return {};
+    }
+    return {m_hits.data() + it->second.first, it->second.count};
+}
+
+} // namespace mcarve
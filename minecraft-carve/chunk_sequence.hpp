@@ -0,0 +1,63 @@
+#ifndef CHUNK_SEQUENCE_H_
+#define CHUNK_SEQUENCE_H_
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+namespace mcarve {
+
+//! Chunk indices of four chunks that follow each other in a region file.
+using ChunkSequence = std::array<uint16_t, 4>;
+
+//! An offset table containing a chunk sequence.
+struct SequenceHit {
+    uint32_t table;  //!< Number the table was added under.
+    uint32_t sector; //!< Sector of the first chunk of the sequence.
+};
+
+//! Hash index of the four-chunk sequences of a set of offset tables.
+//!
+//! Each offset table lists its chunks in sector order, which is the order
+//! the chunks were first saved in.  An ordered run of four chunk indices
+//! picks out its table almost uniquely, so a fragment of chunk data found on
+//! disk can be placed in its region file by looking up the sequences of its
+//! chunks.  Sequences found in more than one table are kept with all their
+//! tables, so callers can tell and report the collision.
+class ChunkSequenceIndex {
+  public:
+    //! Adds every sequence of an offset table, given as its decoded entries,
+    //! sector << 8 | sector count.  Tables must be added before build().
+    void add_table(uint32_t table, std::span<const uint32_t> offsets);
+
+    //! Builds the hash index of the sequences added.
+    void build();
+
+    //! Returns the tables containing a sequence, in the order they were
+    //! added.  More than one hit is a collision.
+    std::span<const SequenceHit> find(const ChunkSequence &sequence) const;
+
+    //! Number of distinct sequences found in more than one table.
+    std::size_t collisions() const { return m_collisions; }
+
+  private:
+    struct Entry {
+        uint64_t key;
+        SequenceHit hit;
+    };
+    struct Range {
+        uint32_t first;
+        uint32_t count;
+    };
+
+    std::vector<Entry> m_entries;
+    std::vector<SequenceHit> m_hits;
+    std::unordered_map<uint64_t, Range> m_index;
+    std::size_t m_collisions = 0;
+};
+
+} // namespace mcarve
+
+#endif // CHUNK_SEQUENCE_H_
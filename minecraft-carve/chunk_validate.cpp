@@ -0,0 +1,97 @@
+// chunk_validate.cpp
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "chunk_validate.hpp"
+#include "sector.hpp"
+
+namespace mcarve {
+
+namespace {
+
+// The chunk data starts with a 4-byte length and a compression type byte.
+constexpr std::size_t CHUNK_PREFIX = 5;
+
+} // namespace
+
+ChunkValidator::ChunkValidator() : m_strm{} {
+    if (inflateInit(&m_strm) != Z_OK) {
+        throw std::runtime_error("Failed to initialize zlib");
+    }
+}
+
+ChunkValidator::~ChunkValidator() { inflateEnd(&m_strm); }
+
+ChunkStatus ChunkValidator::validate(std::span<const unsigned char> data,
+                                     ChunkTags *tags, uint8_t wanted) {
+    const uint32_t length = encoded_chunk_length(data);
+    if (length < 1 || data.size() <= CHUNK_PREFIX) {
+        return ChunkStatus::TRUNCATED;
+    }
+    // The length counts the compression type byte but not itself.
+    const std::size_t end = std::min<std::size_t>(data.size(), 4 + length);
+
+    inflateReset(&m_strm);
+    m_strm.next_in = const_cast<unsigned char *>(data.data() + CHUNK_PREFIX);
+    m_strm.avail_in = end > CHUNK_PREFIX ? end - CHUNK_PREFIX : 0;
+    m_strm.next_out = m_out.data();
+    m_strm.avail_out = m_out.size();
+    m_probe.reset(wanted);
+    std::size_t probed = 0;
+
+    auto finish = [&](ChunkStatus status) {
+        if (tags) {
+            *tags = status == ChunkStatus::VALID ? m_probe.tags() : ChunkTags{};
+        }
+        return status;
+    };
+
+    for (;;) {
+        // Inflate in small steps until the proof is found, so that it is
+        // found early.
+        const unsigned avail = m_strm.avail_in;
+        if (!m_probe.proven()) {
+            m_strm.avail_in = std::min(avail, 64u);
+        }
+        const unsigned held_back = avail - m_strm.avail_in;
+        int ret = inflate(&m_strm, Z_NO_FLUSH);
+        m_strm.avail_in += held_back;
+
+        const std::size_t produced = m_out.size() - m_strm.avail_out;
+        const auto status =
+            m_probe.feed({m_out.data() + probed, produced - probed});
+        probed = produced;
+        if (!m_probe.proven()) {
+            if (status == NbtProbe::ERROR || status == NbtProbe::DONE) {
+                return ChunkStatus::NOT_NBT;
+            }
+        } else if (!tags || status != NbtProbe::NEED_MORE) {
+            return finish(ChunkStatus::VALID);
+        }
+
+        if (ret == Z_STREAM_END) {
+            return finish(m_probe.proven() ? ChunkStatus::VALID
+                                           : ChunkStatus::NOT_NBT);
+        }
+        if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            return finish(m_probe.proven() ? ChunkStatus::VALID
+                                           : ChunkStatus::INFLATE_ERROR);
+        }
+        if (m_strm.avail_out == 0) {
+            // The proof fits easily in the output buffer, so a full buffer
+            // before it means a root name that is implausibly long.
+            if (!m_probe.proven()) {
+                return ChunkStatus::NOT_NBT;
+            }
+            m_strm.next_out = m_out.data();
+            m_strm.avail_out = m_out.size();
+            probed = 0;
+        } else if (m_strm.avail_in == 0) {
+            return finish(m_probe.proven() ? ChunkStatus::VALID
+                                           : ChunkStatus::TRUNCATED);
+        }
+    }
+}
+
+} // namespace mcarve
@@ -0,0 +1,52 @@
+#ifndef CHUNK_VALIDATE_H_
+#define CHUNK_VALIDATE_H_
+
+#include <array>
+#include <cstdint>
+#include <span>
+
+#include <zlib.h>
+
+#include "nbt_probe.hpp"
+
+namespace mcarve {
+
+enum class ChunkStatus {
+    VALID,         //!< Inflates to an NBT root compound tag.
+    INFLATE_ERROR, //!< The zlib stream is corrupt.
+    NOT_NBT,       //!< Inflates to something other than NBT.
+    TRUNCATED,     //!< The data ran out before anything was proven.
+};
+
+//! Checks candidate chunk starts by inflating the beginning of their data.
+//!
+//! Inflation stops at the first proof of NBT structure, a root compound tag
+//! followed by a valid tag type, or at the first inflate error.  When the
+//! chunk's tags are asked for, inflation instead goes on until NbtProbe has
+//! found the wanted ones or the data runs out.  Output goes to a small fixed
+//! buffer that is reused as the probe consumes it, so one validator per
+//! thread is enough.
+class ChunkValidator {
+  public:
+    ChunkValidator();
+    ~ChunkValidator();
+    ChunkValidator(const ChunkValidator &) = delete;
+    ChunkValidator &operator=(const ChunkValidator &) = delete;
+
+    //! Validates the encoded chunk at the start of `data`, which holds the
+    //! chunk's first block and possibly the blocks that follow it.  If `tags`
+    //! is given, the `wanted` ChunkTag flags are looked for and the tags
+    //! found in a valid chunk are stored there.
+    ChunkStatus validate(std::span<const unsigned char> data,
+                         ChunkTags *tags = nullptr,
+                         uint8_t wanted = TAG_ALL);
+
+  private:
+    z_stream m_strm;
+    NbtProbe m_probe;
+    std::array<unsigned char, 4096> m_out;
+};
+
+} // namespace mcarve
+
+#endif // CHUNK_VALIDATE_H_
@@ -0,0 +1,243 @@
+// continuation.cpp
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <mutex>
+#include <stdexcept>
+
+#include <zlib.h>
+
+#include "continuation.hpp"
+#include "parallel.hpp"
+#include "sector.hpp"
+
+namespace mcarve {
+
+namespace {
+
+// The chunk data starts with a 4-byte length and a compression type byte.
+constexpr std::size_t CHUNK_PREFIX = 5;
+constexpr std::size_t MAX_CHUNK_LENGTH = 1 << 20;
+// Input is fed in small steps so that bad data fails early.
+constexpr std::size_t FEED_STEP = 256;
+constexpr uint64_t BATCH_BLOCKS = 256;
+
+//! Per-thread cache of zlib allocations.  Every trial copies a snapshot with
+//! inflateCopy() and frees it again, so after the first trial the same state
+//! and window buffers are reused instead of going back to malloc.
+struct AllocCache {
+    static constexpr std::size_t HEADER = alignof(std::max_align_t);
+    std::vector<std::pair<std::size_t, void *>> free_list;
+
+    ~AllocCache() {
+        for (auto [size, p] : free_list) {
+            std::free(p);
+        }
+    }
+};
+
+thread_local AllocCache alloc_cache;
+
+voidpf cached_alloc(voidpf, uInt items, uInt size) {
+    const std::size_t bytes = std::size_t{items} * size;
+    auto &free_list = alloc_cache.free_list;
+    for (auto it = free_list.begin(); it != free_list.end(); ++it) {
+        if (it->first == bytes) {
+            void *p = it->second;
+            free_list.erase(it);
+            return static_cast<char *>(p) + AllocCache::HEADER;
+        }
+    }
+    void *p = std::malloc(bytes + AllocCache::HEADER);
+    if (p == nullptr) {
+        return Z_NULL;
+    }
+    *static_cast<std::size_t *>(p) = bytes;
+    return static_cast<char *>(p) + AllocCache::HEADER;
+}
+
+void cached_free(voidpf, voidpf address) {
+    void *p = static_cast<char *>(address) - AllocCache::HEADER;
+    alloc_cache.free_list.emplace_back(*static_cast<std::size_t *>(p), p);
+}
+
+//! Feeds `input` to the stream and discards the output.  Returns Z_OK once
+//! all of it is consumed, Z_STREAM_END if the stream ends within it, or the
+//! zlib error that stopped it.
+int feed(z_stream &strm, std::span<const unsigned char> input) {
+    thread_local std::array<unsigned char, 32768> sink;
+    for (std::size_t pos = 0; pos < input.size(); pos += FEED_STEP) {
+        strm.next_in = const_cast<unsigned char *>(input.data() + pos);
+        strm.avail_in = std::min(FEED_STEP, input.size() - pos);
+        while (strm.avail_in > 0) {
+            strm.next_out = sink.data();
+            strm.avail_out = sink.size();
+            int ret = inflate(&strm, Z_NO_FLUSH);
+            if (ret == Z_STREAM_END) {
+                return ret;
+            }
+            if (ret != Z_OK) {
+                return ret == Z_BUF_ERROR ? Z_DATA_ERROR : ret;
+            }
+        }
+    }
+    return Z_OK;
+}
+
+//! Tells whether `block` is an acceptable next piece of a stream that still
+//! expects `remaining` compressed bytes.
+bool accepts(const z_stream &snapshot, uint64_t remaining,
+             std::span<const unsigned char> block) {
+    // Zeros can be valid deflate data, but never a whole block of it.
+    const std::size_t n = std::min<uint64_t>(block.size(), remaining);
+    if (is_all_zero(block.first(n))) {
+        return false;
+    }
+
+    z_stream trial;
+    if (inflateCopy(&trial, const_cast<z_stream *>(&snapshot)) != Z_OK) {
+        throw std::runtime_error("inflateCopy failed");
+    }
+    const int ret = feed(trial, block.first(n));
+    inflateEnd(&trial);
+    // The stream must run on past this block, or end in it if it is the
+    // chunk's last block.
+    return n < remaining ? ret == Z_OK : ret == Z_STREAM_END;
+}
+
+} // namespace
+
+struct ContinuationMatcher::Snapshot {
+    uint64_t chunk_blk;
+    uint32_t position;     //!< Index of the next block needed.
+    uint64_t remaining_in; //!< Compressed bytes expected after this point.
+    z_stream strm;
+
+    ~Snapshot() { inflateEnd(&strm); }
+};
+
+ContinuationMatcher::ContinuationMatcher() = default;
+ContinuationMatcher::~ContinuationMatcher() = default;
+
+bool ContinuationMatcher::add_chunk(BlockReader &reader, uint64_t blknum) {
+    BlockBuffer buf;
+    auto block = reader.view_block(blknum, buf);
+    const uint32_t length = encoded_chunk_length(block);
+    if (length < 1 || length > MAX_CHUNK_LENGTH) {
+        return false;
+    }
+    // The length counts the compression type byte but not itself.
+    if (4 + length <= BLOCKSIZE) {
+        return false;
+    }
+    const uint64_t total_blocks = (4 + length + BLOCKSIZE - 1) / BLOCKSIZE;
+
+    auto snap = std::make_unique<Snapshot>();
+    snap->chunk_blk = blknum;
+    snap->strm = {};
+    snap->strm.zalloc = cached_alloc;
+    snap->strm.zfree = cached_free;
+    if (inflateInit(&snap->strm) != Z_OK) {
+        throw std::runtime_error("Failed to initialize zlib");
+    }
+    auto first = block.subspan(CHUNK_PREFIX);
+    if (feed(snap->strm, first) != Z_OK) {
+        return false;
+    }
+    snap->remaining_in = length - 1 - first.size();
+
+    for (uint32_t k = 1; k < total_blocks; ++k) {
+        snap->position = k;
+        if (blknum + k >= reader.blocks_count()) {
+            break;
+        }
+        block = reader.view_block(blknum + k, buf);
+        if (!accepts(snap->strm, snap->remaining_in, block)) {
+            break;
+        }
+        if (snap->remaining_in <= BLOCKSIZE) {
+            // The chunk inflates completely from contiguous blocks.
+            return false;
+        }
+        // Advance the snapshot past the block that fit.
+        feed(snap->strm, block);
+        snap->remaining_in -= BLOCKSIZE;
+    }
+    m_snapshots.push_back(std::move(snap));
+    return true;
+}
+
+std::vector<Continuation>
+ContinuationMatcher::match(BlockReader &reader,
+                           std::span<const BlockExtent> candidates,
+                           unsigned threads, ContinuationStats &stats) const {
+    std::vector<BlockExtent> batches;
+    for (auto extent : candidates) {
+        while (extent.length > 0) {
+            const uint64_t n = std::min(extent.length, BATCH_BLOCKS);
+            batches.push_back({extent.start, n});
+            extent.start += n;
+            extent.length -= n;
+        }
+    }
+
+    struct BatchResult {
+        std::vector<Continuation> found;
+        uint64_t pairs = 0;
+    };
+    std::mutex reader_mutex;
+
+    auto work = [&](std::size_t i) {
+        thread_local std::vector<unsigned char> scratch;
+        const BlockExtent &batch = batches[i];
+        scratch.resize(batch.length * BLOCKSIZE);
+        std::span<const unsigned char> data;
+        {
+            std::unique_lock<std::mutex> lock(reader_mutex, std::defer_lock);
+            if (!reader.concurrent_reads()) {
+                lock.lock();
+            }
+            data = reader.view_blocks(batch.start, batch.length, scratch);
+        }
+
+        BatchResult result;
+        for (uint64_t b = 0; b < batch.length; ++b) {
+            const uint64_t blk = batch.start + b;
+            auto block = data.subspan(b * BLOCKSIZE, BLOCKSIZE);
+            // accepts() turns down a zero block for every chunk.
+            if (is_all_zero(block)) {
+                continue;
+            }
+            for (const auto &snap : m_snapshots) {
+                // Skip the blocks the chunk already runs through.
+                if (blk >= snap->chunk_blk &&
+                    blk < snap->chunk_blk + snap->position) {
+                    continue;
+                }
+                ++result.pairs;
+                if (accepts(snap->strm, snap->remaining_in, block)) {
+                    result.found.push_back(
+                        {snap->chunk_blk, snap->position, blk});
+                }
+            }
+        }
+        return result;
+    };
+
+    std::vector<Continuation> found;
+    const auto start = std::chrono::steady_clock::now();
+    ordered_parallel_for<BatchResult>(
+        batches.size(), threads, work, [&](BatchResult &&result) {
+            found.insert(found.end(), result.found.begin(),
+                         result.found.end());
+            stats.pairs_tested += result.pairs;
+        });
+    stats.seconds += std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    return found;
+}
+
+} // namespace mcarve
@@ -0,0 +1,68 @@
+#ifndef CONTINUATION_H_
+#define CONTINUATION_H_
+
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <vector>
+
+#include "BlockReader.hpp"
+#include "extent.hpp"
+
+namespace mcarve {
+
+//! A block found to continue the data of a fragmented chunk.
+struct Continuation {
+    uint64_t chunk_blk; //!< First block of the chunk.
+    uint32_t position;  //!< Index of the continued block within the chunk.
+    uint64_t next_blk;  //!< Block that inflates cleanly at that position.
+};
+
+struct ContinuationStats {
+    //! Pairs of a block and a chunk that were trial-inflated.  Zero blocks
+    //! and the blocks that a chunk already runs through are not tried.
+    uint64_t pairs_tested = 0;
+    double seconds = 0;
+
+    double pairs_per_second() const {
+        return seconds > 0 ? pairs_tested / seconds : 0;
+    }
+};
+
+//! Glues fragmented chunk data back together by trial inflation.
+//!
+//! Each incomplete chunk is inflated once, up to the last block boundary
+//! that its contiguous blocks reach without error, and the zlib state there
+//! is kept as a snapshot.  Candidate next blocks are then tested from a copy
+//! of the snapshot.  Input is fed a few hundred bytes at a time, so most
+//! wrong blocks are rejected at their first inflate error.
+class ContinuationMatcher {
+  public:
+    ContinuationMatcher();
+    ~ContinuationMatcher();
+    ContinuationMatcher(const ContinuationMatcher &) = delete;
+    ContinuationMatcher &operator=(const ContinuationMatcher &) = delete;
+
+    //! Inflates the chunk starting at `blknum` through its contiguous blocks.
+    //! If it breaks off at a block boundary, keeps a snapshot for matching
+    //! and returns true.  Returns false for a chunk that inflates completely
+    //! or that fails within its first block.
+    bool add_chunk(BlockReader &reader, uint64_t blknum);
+
+    //! Number of incomplete chunks held.
+    std::size_t size() const { return m_snapshots.size(); }
+
+    //! Tests every block of the candidate extents against every incomplete
+    //! chunk on `threads` threads.  Results are in candidate block order.
+    std::vector<Continuation>
+    match(BlockReader &reader, std::span<const BlockExtent> candidates,
+          unsigned threads, ContinuationStats &stats) const;
+
+  private:
+    struct Snapshot;
+    std::vector<std::unique_ptr<Snapshot>> m_snapshots;
+};
+
+} // namespace mcarve
+
+#endif // CONTINUATION_H_
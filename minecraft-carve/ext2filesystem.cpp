@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cerrno>
 #include <fstream>
 #include <stdexcept>
 
@@ -47,6 +49,43 @@ bool Ext2Filesystem::block_is_used(uint64_t blk) const {
     return ext2fs_test_block_bitmap2(m_fs->block_map, blk);
 }
 
+std::vector<BlockExtent> Ext2Filesystem::free_extents(uint64_t first,
+                                                      uint64_t last) const {
+    ext2fs_block_bitmap bmap = m_fs->block_map;
+    first = std::max<uint64_t>(first, ext2fs_get_block_bitmap_start2(bmap));
+    last = std::min<uint64_t>(last, ext2fs_get_block_bitmap_end2(bmap) + 1);
+
+    std::vector<BlockExtent> extents;
+    blk64_t start = first;
+    while (start < last) {
+        blk64_t free_start;
+        errcode_t errval = ext2fs_find_first_zero_block_bitmap2(
+            bmap, start, last - 1, &free_start);
+        if (errval == ENOENT) {
+            break;
+        } else if (errval) {
+            com_err("Ext2Filesystem::free_extents()", errval,
+                    "while searching block bitmap");
+            throw std::runtime_error("Could not search block bitmap");
+        }
+
+        blk64_t used_start;
+        errval = ext2fs_find_first_set_block_bitmap2(bmap, free_start,
+                                                     last - 1, &used_start);
+        if (errval == ENOENT) {
+            used_start = last;
+        } else if (errval) {
+            com_err("Ext2Filesystem::free_extents()", errval,
+                    "while searching block bitmap");
+            throw std::runtime_error("Could not search block bitmap");
+        }
+
+        extents.push_back({free_start, used_start - free_start});
+        start = used_start;
+    }
+    return extents;
+}
+
 void Ext2Filesystem::read_block(uint64_t blk, std::vector<unsigned char> &data,
                                 unsigned count) const {
     if (data.size() != count * m_fs->blocksize) {
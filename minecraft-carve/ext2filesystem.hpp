@@ -7,6 +7,8 @@
 
 #include <ext2fs/ext2fs.h>
 
+#include "extent.hpp"
+
 namespace mcarve {
 
 bool IdentifyExt2FS(const std::string &filename);
@@ -17,6 +19,8 @@ class Ext2Filesystem {
     ~Ext2Filesystem();
 
     bool block_is_used(uint64_t blk) const;
+    //! Returns the unused blocks within [first, last) as sorted extents.
+    std::vector<BlockExtent> free_extents(uint64_t first, uint64_t last) const;
     void read_block(uint64_t blk, std::vector<unsigned char> &data,
                     unsigned count = 1) const;
     void read_block(uint64_t blk, void *data, unsigned count = 1) const;
@@ -0,0 +1,59 @@
+// extent.cpp
+
+#include <algorithm>
+#include <cerrno>
+#include <stdexcept>
+#include <string>
+
+#include <unistd.h>
+
+#include "extent.hpp"
+
+namespace mcarve {
+
+std::vector<BlockExtent> data_extents(int fd, uint64_t first, uint64_t last,
+                                      uint64_t blocksize) {
+    std::vector<BlockExtent> extents;
+    if (first >= last) {
+        return extents;
+    }
+    const off_t end = last * blocksize;
+    off_t pos = first * blocksize;
+    while (pos < end) {
+        const off_t data = lseek(fd, pos, SEEK_DATA);
+        if (data < 0) {
+            if (errno == ENXIO) {
+                // No data past pos.
+                break;
+            }
+            if (errno == EINVAL && extents.empty()) {
+                // SEEK_DATA is not supported here.
+                return {{first, last - first}};
+            }
+            throw std::runtime_error("Failed to find data in image at " +
+                                     std::to_string(pos));
+        }
+        if (data >= end) {
+            break;
+        }
+        off_t hole = lseek(fd, data, SEEK_HOLE);
+        if (hole < 0) {
+            throw std::runtime_error("Failed to find hole in image at " +
+                                     std::to_string(data));
+        }
+        hole = std::min(hole, end);
+
+        // Round out to whole blocks.
+        const uint64_t start = data / blocksize;
+        const uint64_t stop = (hole + blocksize - 1) / blocksize;
+        if (!extents.empty() && extents.back().end() >= start) {
+            extents.back().length = stop - extents.back().start;
+        } else {
+            extents.push_back({start, stop - start});
+        }
+        pos = hole;
+    }
+    return extents;
+}
+
+} // namespace mcarve
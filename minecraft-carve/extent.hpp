@@ -0,0 +1,29 @@
+#ifndef EXTENT_H_
+#define EXTENT_H_
+
+#include <cstdint>
+#include <vector>
+
+namespace mcarve {
+
+//! A run of `length` consecutive blocks beginning at block `start`.
+struct BlockExtent {
+    uint64_t start;
+    uint64_t length;
+
+    uint64_t end() const { return start + length; }
+
+    bool operator==(const BlockExtent &) const = default;
+};
+
+//! Returns the sorted extents of `blocksize`-byte blocks within [first, last)
+//! that hold data in the open file `fd`, found with lseek(SEEK_DATA) and
+//! lseek(SEEK_HOLE).  A block that is partly data counts as data.  Holes
+//! read as zeros, so they need no scanning.  Where the filesystem cannot
+//! report holes, the whole range is returned.
+std::vector<BlockExtent> data_extents(int fd, uint64_t first, uint64_t last,
+                                      uint64_t blocksize);
+
+} // namespace mcarve
+
+#endif // EXTENT_H_
@@ -0,0 +1,98 @@
+// header_match.cpp
+
+#include <algorithm>
+#include <unordered_map>
+
+#include "header_match.hpp"
+#include "sector.hpp"
+
+namespace mcarve {
+
+namespace {
+
+struct PresenceHasher {
+    std::size_t operator()(const PresenceBitmap &bitmap) const {
+        return presence_hash(bitmap);
+    }
+};
+
+struct TableGroup {
+    std::vector<uint64_t> offsets;
+    std::vector<uint64_t> timestamps;
+};
+
+bool is_full(const PresenceBitmap &bitmap) {
+    return std::all_of(bitmap.begin(), bitmap.end(),
+                       [](uint8_t b) { return b == 0xff; });
+}
+
+} // namespace
+
+HeaderMatches match_headers(std::span<const CandidateRecord> candidates,
+                            BlockReader &reader) {
+    std::unordered_map<PresenceBitmap, TableGroup, PresenceHasher> groups;
+    BlockBuffer buf;
+    for (const auto &rec : candidates) {
+        if (!(rec.types & (SECTOR_OFFSETS | SECTOR_TIMESTAMPS))) {
+            continue;
+        }
+        auto &group = groups[presence_bitmap(reader.view_block(rec.blknum,
+                                                               buf))];
+        if (rec.types & SECTOR_OFFSETS) {
+            group.offsets.push_back(rec.blknum);
+        }
+        if (rec.types & SECTOR_TIMESTAMPS) {
+            group.timestamps.push_back(rec.blknum);
+        }
+    }
+
+    HeaderMatches matches;
+    for (auto &[bitmap, group] : groups) {
+        // Candidates arrive in block order, so both lists are sorted.  Pair
+        // each offset table with a timestamp table in the next block.
+        std::vector<uint64_t> offsets;
+        std::vector<uint64_t> timestamps;
+        auto ts = group.timestamps.begin();
+        for (uint64_t blk : group.offsets) {
+            while (ts != group.timestamps.end() && *ts <= blk) {
+                timestamps.push_back(*ts++);
+            }
+            if (ts != group.timestamps.end() && *ts == blk + 1) {
+                matches.pairs.push_back({blk, *ts++, true});
+            } else {
+                offsets.push_back(blk);
+            }
+        }
+        timestamps.insert(timestamps.end(), ts, group.timestamps.end());
+
+        if (offsets.size() == 1 && timestamps.size() == 1) {
+            matches.pairs.push_back({offsets[0], timestamps[0], false});
+        } else if (!offsets.empty() && !timestamps.empty()) {
+            matches.collisions.push_back(
+                {std::move(offsets), std::move(timestamps), is_full(bitmap)});
+        } else {
+            matches.unmatched_offsets.insert(matches.unmatched_offsets.end(),
+                                             offsets.begin(), offsets.end());
+            matches.unmatched_timestamps.insert(
+                matches.unmatched_timestamps.end(), timestamps.begin(),
+                timestamps.end());
+        }
+    }
+
+    // Report in block order regardless of hash table order.
+    std::sort(matches.pairs.begin(), matches.pairs.end(),
+              [](const HeaderPair &a, const HeaderPair &b) {
+                  return a.offsets_blk < b.offsets_blk;
+              });
+    std::sort(matches.collisions.begin(), matches.collisions.end(),
+              [](const HeaderCollision &a, const HeaderCollision &b) {
+                  return a.offsets_blks[0] < b.offsets_blks[0];
+              });
+    std::sort(matches.unmatched_offsets.begin(),
+              matches.unmatched_offsets.end());
+    std::sort(matches.unmatched_timestamps.begin(),
+              matches.unmatched_timestamps.end());
+    return matches;
+}
+
+} // namespace mcarve
@@ -0,0 +1,49 @@
+#ifndef HEADER_MATCH_H_
+#define HEADER_MATCH_H_
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "BlockReader.hpp"
+#include "candidates.hpp"
+
+namespace mcarve {
+
+//! An offset table matched with the timestamp table of the same region file.
+struct HeaderPair {
+    uint64_t offsets_blk;
+    uint64_t timestamps_blk;
+    //! The timestamp table directly follows the offset table on disk.
+    bool adjacent;
+};
+
+//! Tables sharing a presence bitmap that could not be paired one-to-one.
+struct HeaderCollision {
+    std::vector<uint64_t> offsets_blks;
+    std::vector<uint64_t> timestamps_blks;
+    //! Every chunk is present, so the bitmap carries no information.
+    bool full_region;
+};
+
+struct HeaderMatches {
+    std::vector<HeaderPair> pairs;
+    std::vector<HeaderCollision> collisions;
+    std::vector<uint64_t> unmatched_offsets;
+    std::vector<uint64_t> unmatched_timestamps;
+};
+
+//! Pass 2: pairs the offset and timestamp tables among the candidates by
+//! their chunk presence bitmaps.
+//!
+//! The bitmaps are read from the image and grouped in a hash index.  Within
+//! a group, a timestamp table in the block right after an offset table is
+//! paired with it first.  A group left with exactly one table of each kind
+//! is paired as well.  Anything else is reported as a collision, as happens
+//! for full regions which all share the all-ones bitmap.
+HeaderMatches match_headers(std::span<const CandidateRecord> candidates,
+                            BlockReader &reader);
+
+} // namespace mcarve
+
+#endif // HEADER_MATCH_H_
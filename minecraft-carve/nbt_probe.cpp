@@ -0,0 +1,290 @@
+// nbt_probe.cpp
+
+#include <algorithm>
+#include <cstring>
+#include <string_view>
+
+#include "nbt_probe.hpp"
+
+namespace mcarve {
+
+namespace {
+
+constexpr uint8_t TAG_END = 0;
+constexpr uint8_t TAG_BYTE = 1;
+constexpr uint8_t TAG_SHORT = 2;
+constexpr uint8_t TAG_INT = 3;
+constexpr uint8_t TAG_LONG = 4;
+constexpr uint8_t TAG_FLOAT = 5;
+constexpr uint8_t TAG_DOUBLE = 6;
+constexpr uint8_t TAG_BYTE_ARRAY = 7;
+constexpr uint8_t TAG_STRING = 8;
+constexpr uint8_t TAG_LIST = 9;
+constexpr uint8_t TAG_COMPOUND = 10;
+constexpr uint8_t TAG_INT_ARRAY = 11;
+constexpr uint8_t TAG_LONG_ARRAY = 12;
+
+//! Payload size of a fixed-size tag type, or zero.
+std::size_t fixed_size(uint8_t type) {
+    switch (type) {
+    case TAG_BYTE:
+        return 1;
+    case TAG_SHORT:
+        return 2;
+    case TAG_INT:
+    case TAG_FLOAT:
+        return 4;
+    case TAG_LONG:
+    case TAG_DOUBLE:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+//! Element size of an array tag type, or zero.
+std::size_t array_element_size(uint8_t type) {
+    switch (type) {
+    case TAG_BYTE_ARRAY:
+        return 1;
+    case TAG_INT_ARRAY:
+        return 4;
+    case TAG_LONG_ARRAY:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+struct WantedTag {
+    std::string_view name;
+    uint8_t type;
+    ChunkTag flag;
+};
+
+constexpr WantedTag WANTED_TAGS[] = {
+    {"xPos", TAG_INT, TAG_X_POS},
+    {"zPos", TAG_INT, TAG_Z_POS},
+    {"DataVersion", TAG_INT, TAG_DATA_VERSION},
+    {"LastUpdate", TAG_LONG, TAG_LAST_UPDATE},
+    {"InhabitedTime", TAG_LONG, TAG_INHABITED_TIME},
+};
+
+} // namespace
+
+void NbtProbe::reset() {
+    m_tags = {};
+    m_status = NEED_MORE;
+    m_proven = false;
+    m_skip = 0;
+    m_depth = 0;
+    m_name_length = 0;
+    expect(ROOT_TYPE, 1);
+}
+
+void NbtProbe::expect(State state, std::size_t bytes) {
+    m_state = state;
+    m_need = bytes;
+    m_have = 0;
+}
+
+uint64_t NbtProbe::value(std::size_t offset, std::size_t bytes) const {
+    uint64_t v = 0;
+    for (std::size_t i = 0; i < bytes; ++i) {
+        v = v << 8 | m_buf[offset + i];
+    }
+    return v;
+}
+
+NbtProbe::Status NbtProbe::feed(std::span<const unsigned char> data) {
+    std::size_t pos = 0;
+    while (m_status == NEED_MORE) {
+        if (m_skip > 0) {
+            const auto n = std::min<uint64_t>(m_skip, data.size() - pos);
+            pos += n;
+            m_skip -= n;
+            if (m_skip > 0) {
+                break;
+            }
+            continue;
+        }
+        if (m_have < m_need) {
+            const auto n = std::min(m_need - m_have, data.size() - pos);
+            memcpy(m_buf.data() + m_have, data.data() + pos, n);
+            m_have += n;
+            pos += n;
+            if (m_have < m_need) {
+                break;
+            }
+        }
+        step();
+    }
+    return m_status;
+}
+
+void NbtProbe::step() {
+    switch (m_state) {
+    case ROOT_TYPE:
+        if (m_buf[0] != TAG_COMPOUND) {
+            m_status = ERROR;
+            return;
+        }
+        expect(ROOT_NAME_LENGTH, 2);
+        break;
+    case ROOT_NAME_LENGTH:
+        m_skip = value(0, 2);
+        m_stack[m_depth++] = {TAG_END, 0};
+        expect(TAG_TYPE, 1);
+        break;
+    case TAG_TYPE:
+        m_type = m_buf[0];
+        if (m_type > TAG_LONG_ARRAY) {
+            m_status = ERROR;
+            return;
+        }
+        m_proven = true;
+        if (m_type == TAG_END) {
+            --m_depth;
+            next_element();
+            return;
+        }
+        expect(NAME_LENGTH, 2);
+        break;
+    case NAME_LENGTH: {
+        const std::size_t length = value(0, 2);
+        if (length > MAX_NAME) {
+            // Too long to be one of the wanted names.
+            m_name_length = 0;
+            m_skip = length;
+            expect(PAYLOAD, 0);
+        } else {
+            m_name_length = length;
+            expect(NAME, length);
+        }
+        break;
+    }
+    case NAME:
+        memcpy(m_name.data(), m_buf.data(), m_name_length);
+        expect(PAYLOAD, 0);
+        break;
+    case PAYLOAD:
+        begin_payload();
+        break;
+    case SCALAR:
+        store_scalar();
+        next_element();
+        break;
+    case ARRAY_LENGTH: {
+        const auto length = static_cast<int32_t>(value(0, 4));
+        if (length < 0) {
+            m_status = ERROR;
+            return;
+        }
+        m_skip = uint64_t(length) * array_element_size(m_type);
+        next_element();
+        break;
+    }
+    case STRING_LENGTH:
+        m_skip = value(0, 2);
+        next_element();
+        break;
+    case LIST_HEADER: {
+        const uint8_t type = m_buf[0];
+        const auto length = static_cast<int32_t>(value(1, 4));
+        if (type > TAG_LONG_ARRAY) {
+            m_status = ERROR;
+            return;
+        }
+        if (length <= 0 || type == TAG_END) {
+            next_element();
+        } else if (std::size_t size = fixed_size(type)) {
+            m_skip = uint64_t(length) * size;
+            next_element();
+        } else if (m_depth == MAX_DEPTH) {
+            m_status = ERROR;
+        } else {
+            m_stack[m_depth++] = {type, length};
+            next_element();
+        }
+        break;
+    }
+    }
+}
+
+void NbtProbe::begin_payload() {
+    if (std::size_t size = fixed_size(m_type)) {
+        expect(SCALAR, size);
+    } else if (array_element_size(m_type)) {
+        expect(ARRAY_LENGTH, 4);
+    } else if (m_type == TAG_STRING) {
+        expect(STRING_LENGTH, 2);
+    } else if (m_type == TAG_LIST) {
+        expect(LIST_HEADER, 5);
+    } else if (m_depth == MAX_DEPTH) {
+        m_status = ERROR;
+    } else {
+        m_stack[m_depth++] = {TAG_END, 0};
+        expect(TAG_TYPE, 1);
+    }
+}
+
+void NbtProbe::next_element() {
+    while (m_depth > 0) {
+        Frame &frame = m_stack[m_depth - 1];
+        if (frame.list_type == TAG_END) {
+            expect(TAG_TYPE, 1);
+            return;
+        }
+        if (frame.remaining > 0) {
+            --frame.remaining;
+            m_type = frame.list_type;
+            m_name_length = 0;
+            expect(PAYLOAD, 0);
+            return;
+        }
+        --m_depth;
+    }
+    // The root compound has ended.
+    m_status = DONE;
+}
+
+void NbtProbe::store_scalar() {
+    // Only named tags of the root compound and of the compounds directly
+    // inside it are of interest.
+    if (m_depth > 2 || m_stack[m_depth - 1].list_type != TAG_END) {
+        return;
+    }
+    const std::string_view name(m_name.data(), m_name_length);
+    for (const auto &wanted : WANTED_TAGS) {
+        if (!(m_wanted & wanted.flag) || (m_tags.found & wanted.flag) ||
+            wanted.type != m_type || wanted.name != name) {
+            continue;
+        }
+        switch (wanted.flag) {
+        case TAG_X_POS:
+            m_tags.x_pos = static_cast<int32_t>(value(0, 4));
+            break;
+        case TAG_Z_POS:
+            m_tags.z_pos = static_cast<int32_t>(value(0, 4));
+            break;
+        case TAG_DATA_VERSION:
+            m_tags.data_version = static_cast<int32_t>(value(0, 4));
+            break;
+        case TAG_LAST_UPDATE:
+            m_tags.last_update = static_cast<int64_t>(value(0, 8));
+            break;
+        case TAG_INHABITED_TIME:
+            m_tags.inhabited_time = static_cast<int64_t>(value(0, 8));
+            break;
+        default:
+            break;
+        }
+        m_tags.found |= wanted.flag;
+        if ((m_tags.found & m_wanted) == m_wanted) {
+            m_status = DONE;
+        }
+        return;
+    }
+}
+
+} // namespace mcarve
@@ -0,0 +1,117 @@
+#ifndef NBT_PROBE_H_
+#define NBT_PROBE_H_
+
+#include <array>
+#include <cstdint>
+#include <span>
+
+namespace mcarve {
+
+//! Flags for the chunk tags extracted by NbtProbe.
+enum ChunkTag : uint8_t {
+    TAG_X_POS = 1 << 0,
+    TAG_Z_POS = 1 << 1,
+    TAG_DATA_VERSION = 1 << 2,
+    TAG_LAST_UPDATE = 1 << 3,
+    TAG_INHABITED_TIME = 1 << 4,
+    TAG_ALL = 0x1f,
+};
+
+//! Scalar tags of a chunk, as far as they were found.
+struct ChunkTags {
+    uint8_t found = 0; //!< ChunkTag flags of the fields below that are set.
+    int32_t x_pos = 0;
+    int32_t z_pos = 0;
+    int32_t data_version = 0;
+    int64_t last_update = 0;
+    int64_t inhabited_time = 0;
+};
+
+//! Streaming NBT scanner that picks a few scalar tags out of a chunk.
+//!
+//! The inflated chunk is fed in pieces of any size.  Nothing is copied or
+//! allocated: strings and arrays such as BlockStates and Heightmaps are
+//! skipped by their length, and only the tags requested are decoded.  The
+//! tags are looked for in the root compound and in the compound one level
+//! below it, where Level sits in older chunk formats.
+class NbtProbe {
+  public:
+    enum Status {
+        NEED_MORE, //!< Feed more data.
+        DONE,      //!< All requested tags found, or the root compound ended.
+        ERROR,     //!< The data is not well-formed NBT.
+    };
+
+    explicit NbtProbe(uint8_t wanted = TAG_ALL) : m_wanted(wanted) {
+        reset();
+    }
+
+    //! Starts over with a new stream.
+    void reset();
+    //! Starts over with a new stream, looking for other tags.
+    void reset(uint8_t wanted) {
+        m_wanted = wanted;
+        reset();
+    }
+
+    //! Consumes the next piece of the stream.
+    Status feed(std::span<const unsigned char> data);
+
+    //! Tells whether the data so far begins like NBT: a root compound whose
+    //! first tag has a valid type.
+    bool proven() const { return m_proven; }
+
+    const ChunkTags &tags() const { return m_tags; }
+
+  private:
+    enum State {
+        ROOT_TYPE,
+        ROOT_NAME_LENGTH,
+        TAG_TYPE,
+        NAME_LENGTH,
+        NAME,
+        PAYLOAD,
+        SCALAR,
+        ARRAY_LENGTH,
+        STRING_LENGTH,
+        LIST_HEADER,
+    };
+
+    struct Frame {
+        uint8_t list_type; //!< Element type of a list; zero for a compound.
+        int32_t remaining; //!< Elements left in a list.
+    };
+
+    static constexpr std::size_t MAX_DEPTH = 64;
+    static constexpr std::size_t MAX_NAME = 16;
+
+    void expect(State state, std::size_t bytes);
+    void step();
+    void begin_payload();
+    void next_element();
+    void store_scalar();
+    //! Decodes a big-endian integer from the collected bytes.
+    uint64_t value(std::size_t offset, std::size_t bytes) const;
+
+    uint8_t m_wanted;
+    ChunkTags m_tags;
+    Status m_status;
+    bool m_proven;
+
+    State m_state;
+    std::size_t m_need;
+    std::size_t m_have;
+    uint64_t m_skip;
+    std::array<unsigned char, MAX_NAME> m_buf;
+
+    uint8_t m_type;
+    std::size_t m_name_length;
+    std::array<char, MAX_NAME> m_name;
+
+    std::array<Frame, MAX_DEPTH> m_stack;
+    std::size_t m_depth;
+};
+
+} // namespace mcarve
+
+#endif // NBT_PROBE_H_
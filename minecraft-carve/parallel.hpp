@@ -0,0 +1,116 @@
+#ifndef PARALLEL_H_
+#define PARALLEL_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace mcarve {
+
+//! Runs work(0) .. work(count - 1) on a pool of worker threads and passes
+//! each result to emit() on the calling thread, in index order.
+//!
+//! At most `window` results are in flight at once, so a slow consumer holds
+//! back the workers rather than letting finished results pile up.  The first
+//! exception thrown by work() or emit() stops the pool and is rethrown.
+template <typename Result, typename Work, typename Emit>
+void ordered_parallel_for(std::size_t count, unsigned threads, Work work,
+                          Emit emit, std::size_t window = 0) {
+    if (threads <= 1) {
+        for (std::size_t i = 0; i < count; ++i) {
+            emit(work(i));
+        }
+        return;
+    }
+    if (window == 0) {
+        window = 4 * static_cast<std::size_t>(threads);
+    }
+
+    std::mutex mtx;
+    std::condition_variable cv_ready;
+    std::condition_variable cv_space;
+    std::vector<std::optional<Result>> slots(window);
+    std::size_t next_task = 0;
+    std::size_t next_emit = 0;
+    bool stop = false;
+    std::exception_ptr error;
+
+    auto fail = [&](std::exception_ptr e) {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (!error) {
+            error = e;
+        }
+        stop = true;
+        cv_ready.notify_all();
+        cv_space.notify_all();
+    };
+
+    auto worker = [&]() {
+        for (;;) {
+            std::size_t i;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                cv_space.wait(lock, [&] {
+                    return stop || next_task >= count ||
+                           next_task < next_emit + window;
+                });
+                if (stop || next_task >= count) {
+                    return;
+                }
+                i = next_task++;
+            }
+            try {
+                Result r = work(i);
+                std::lock_guard<std::mutex> lock(mtx);
+                slots[i % window].emplace(std::move(r));
+                cv_ready.notify_all();
+            } catch (...) {
+                fail(std::current_exception());
+                return;
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    pool.reserve(threads);
+    for (unsigned t = 0; t < threads; ++t) {
+        pool.emplace_back(worker);
+    }
+
+    try {
+        for (std::size_t i = 0; i < count; ++i) {
+            Result r;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                auto &slot = slots[i % window];
+                cv_ready.wait(lock, [&] { return stop || slot.has_value(); });
+                if (stop) {
+                    break;
+                }
+                r = std::move(*slot);
+                slot.reset();
+                next_emit = i + 1;
+                cv_space.notify_all();
+            }
+            emit(std::move(r));
+        }
+    } catch (...) {
+        fail(std::current_exception());
+    }
+
+    for (auto &t : pool) {
+        t.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+} // namespace mcarve
+
+#endif // PARALLEL_H_
@@ -0,0 +1,541 @@
+// reassemble.cpp
+
+#include <algorithm>
+#include <cstring>
+#include <tuple>
+#include <unordered_map>
+
+#include "chunk_sequence.hpp"
+#include "reassemble.hpp"
+#include "sector.hpp"
+
+namespace mcarve {
+
+namespace {
+
+//! Mismatched chunks a region may have beyond its matched ones before it is
+//! given up as the owner of an offset table.
+constexpr int64_t MISMATCH_SLACK = 8;
+
+uint64_t region_key(int32_t region_x, int32_t region_z) {
+    return uint64_t{static_cast<uint32_t>(region_x)} << 32 |
+           static_cast<uint32_t>(region_z);
+}
+
+//! A chunk candidate with coordinates, as indexed by (region, chunk index).
+struct LocatedChunk {
+    uint64_t region;
+    uint32_t index;
+    uint32_t sectors;
+    uint64_t blknum;
+
+    bool operator<(const LocatedChunk &other) const {
+        return std::tie(region, index, blknum) <
+               std::tie(other.region, other.index, other.blknum);
+    }
+};
+
+//! The located chunks of one region, sorted by chunk index.
+struct RegionChunks {
+    uint64_t region;
+    std::span<const LocatedChunk> chunks;
+};
+
+//! Region file sectors known to be stored from a given block on.
+struct Anchor {
+    uint32_t sector;
+    uint32_t length;
+    uint64_t blknum;
+
+    int64_t delta() const { return static_cast<int64_t>(blknum) - sector; }
+
+    bool operator<(const Anchor &other) const {
+        return std::tie(sector, blknum) < std::tie(other.sector, other.blknum);
+    }
+};
+
+uint32_t entry_sector(uint32_t entry) { return entry >> 8; }
+uint32_t entry_count(uint32_t entry) { return entry & 0xff; }
+
+//! Tells whether anchors, sorted, hold one at the given sector.
+bool is_anchored(std::span<const Anchor> anchors, uint32_t sector) {
+    return std::binary_search(anchors.begin(), anchors.end(),
+                              Anchor{sector, 0, 0},
+                              [](const Anchor &a, const Anchor &b) {
+                                  return a.sector < b.sector;
+                              });
+}
+
+RegionAssembly read_header(BlockReader &reader, uint64_t offsets_blk) {
+    RegionAssembly region{};
+    region.offsets_blk = offsets_blk;
+    BlockBuffer buf;
+    auto block = reader.view_block(offsets_blk, buf);
+    for (std::size_t i = 0; i < REGION_CHUNKS; ++i) {
+        uint32_t word;
+        memcpy(&word, block.data() + 4 * i, sizeof(word));
+        region.offsets[i] = __builtin_bswap32(word);
+        if (entry_count(region.offsets[i]) > 0) {
+            ++region.chunks_present;
+        }
+    }
+    return region;
+}
+
+//! Scores how well the located chunks of a region fit an offset table:
+//! chunk indices with a candidate of the listed sector count, less those
+//! without.  Stops early once the region is clearly not the owner.
+int64_t fit_score(const RegionAssembly &region, const RegionChunks &chunks) {
+    int64_t matched = 0;
+    int64_t mismatched = 0;
+    auto it = chunks.chunks.begin();
+    while (it != chunks.chunks.end()) {
+        const uint32_t index = it->index;
+        const uint32_t count = entry_count(region.offsets[index]);
+        bool fits = false;
+        for (; it != chunks.chunks.end() && it->index == index; ++it) {
+            fits = fits || it->sectors == count;
+        }
+        if (fits) {
+            ++matched;
+        } else if (++mismatched > matched + MISMATCH_SLACK) {
+            break;
+        }
+    }
+    return matched - mismatched;
+}
+
+//! Picks the region of the best fit, unless another fits as well.
+void locate(RegionAssembly &region, std::span<const RegionChunks> regions) {
+    int64_t best = 0;
+    const RegionChunks *owner = nullptr;
+    for (const auto &chunks : regions) {
+        const int64_t score = fit_score(region, chunks);
+        if (score > best) {
+            best = score;
+            owner = &chunks;
+            region.rivals = 0;
+        } else if (owner && score == best) {
+            ++region.rivals;
+        }
+    }
+    if (owner && region.rivals == 0) {
+        region.located = true;
+        region.region_x = static_cast<int32_t>(owner->region >> 32);
+        region.region_z = static_cast<int32_t>(owner->region);
+    }
+}
+
+//! Picks the region most of the sequences placed in a table belong to,
+//! unless another has as many.
+void locate_by_sequence(RegionAssembly &region,
+                        std::vector<uint64_t> &sequence_regions) {
+    std::sort(sequence_regions.begin(), sequence_regions.end());
+    std::size_t best = 0;
+    uint64_t owner = 0;
+    for (auto it = sequence_regions.begin(); it != sequence_regions.end();) {
+        auto end = std::upper_bound(it, sequence_regions.end(), *it);
+        const std::size_t votes = end - it;
+        if (votes > best) {
+            best = votes;
+            owner = *it;
+            region.rivals = 0;
+        } else if (votes == best) {
+            ++region.rivals;
+        }
+        it = end;
+    }
+    if (best > 0 && region.rivals == 0) {
+        region.located = true;
+        region.region_x = static_cast<int32_t>(owner >> 32);
+        region.region_z = static_cast<int32_t>(owner);
+    }
+}
+
+//! Anchors found for an offset table by the chunk sequence index.
+struct SequencePlacement {
+    std::vector<Anchor> anchors;
+    //! Region of each sequence placed.
+    std::vector<uint64_t> regions;
+};
+
+//! Places the fragments of chunk data in their offset tables by the
+//! sequences of four chunks they hold.  Each run of four chunks with
+//! coordinates, in block order, is looked up in the sequence index.  A
+//! single hit counts if the chunks lie as far apart on disk as the table
+//! puts them and fill the sectors it gives them.  A sequence found in
+//! several tables is reported instead.  Returns the number of distinct
+//! sequences that the tables share.
+std::size_t place_by_sequence(std::span<const RegionAssembly> regions,
+                              std::span<const CandidateRecord> candidates,
+                              std::vector<SequencePlacement> &placements,
+                              std::vector<SequenceCollision> &collisions) {
+    ChunkSequenceIndex index;
+    for (std::size_t t = 0; t < regions.size(); ++t) {
+        index.add_table(t, regions[t].offsets);
+    }
+    index.build();
+
+    std::vector<const CandidateRecord *> chunks;
+    for (const auto &rec : candidates) {
+        if (rec.types & SECTOR_CHUNK_COORDS) {
+            chunks.push_back(&rec);
+        }
+    }
+
+    for (std::size_t i = 0; i + 4 <= chunks.size(); ++i) {
+        const auto window = std::span(chunks).subspan(i, 4);
+        const uint64_t region = region_key(chunk_region(window[0]->x_pos),
+                                           chunk_region(window[0]->z_pos));
+        ChunkSequence sequence;
+        bool same_region = true;
+        for (std::size_t k = 0; k < 4; ++k) {
+            same_region = same_region &&
+                          region_key(chunk_region(window[k]->x_pos),
+                                     chunk_region(window[k]->z_pos)) == region;
+            sequence[k] = chunk_index(window[k]->x_pos, window[k]->z_pos);
+        }
+        if (!same_region) {
+            continue;
+        }
+
+        const auto hits = index.find(sequence);
+        if (hits.size() > 1) {
+            SequenceCollision collision{window[0]->blknum, sequence, {}};
+            for (const auto &hit : hits) {
+                collision.offsets_blks.push_back(
+                    regions[hit.table].offsets_blk);
+            }
+            collisions.push_back(std::move(collision));
+            continue;
+        }
+        if (hits.empty()) {
+            continue;
+        }
+
+        const auto &table = regions[hits[0].table];
+        bool in_line = true;
+        for (std::size_t k = 0; k < 4; ++k) {
+            const uint32_t entry = table.offsets[sequence[k]];
+            in_line = in_line &&
+                      window[k]->blknum - window[0]->blknum ==
+                          entry_sector(entry) - hits[0].sector &&
+                      chunk_sectors(window[k]->chunk_length) ==
+                          entry_count(entry);
+        }
+        if (!in_line) {
+            continue;
+        }
+        auto &placement = placements[hits[0].table];
+        for (std::size_t k = 0; k < 4; ++k) {
+            const uint32_t entry = table.offsets[sequence[k]];
+            placement.anchors.push_back(
+                {entry_sector(entry), entry_count(entry), window[k]->blknum});
+        }
+        placement.regions.push_back(region);
+    }
+    return index.collisions();
+}
+
+//! Anchors each chunk of the owning region at its listed sector, unless
+//! it is anchored already.  Where a chunk index has several candidates, the
+//! one in line with most of the anchors is taken.
+void anchor_located(const RegionAssembly &region, const RegionChunks &chunks,
+                    std::vector<Anchor> &anchors) {
+    std::sort(anchors.begin(), anchors.end());
+    const std::size_t known = anchors.size();
+    std::vector<Anchor> options;
+    std::unordered_map<int64_t, uint32_t> votes;
+    for (std::size_t i = 0; i < known; ++i) {
+        ++votes[anchors[i].delta()];
+    }
+    for (const auto &chunk : chunks.chunks) {
+        const uint32_t entry = region.offsets[chunk.index];
+        if (entry_count(entry) == 0 || chunk.sectors != entry_count(entry)) {
+            continue;
+        }
+        if (is_anchored({anchors.data(), known}, entry_sector(entry))) {
+            continue;
+        }
+        options.push_back({entry_sector(entry), chunk.sectors, chunk.blknum});
+        ++votes[options.back().delta()];
+    }
+    // The options are sorted by chunk index, and so grouped by sector.
+    for (auto it = options.begin(); it != options.end();) {
+        auto best = it;
+        for (++it; it != options.end() && it->sector == best->sector; ++it) {
+            if (votes[it->delta()] > votes[best->delta()]) {
+                best = it;
+            }
+        }
+        anchors.push_back(*best);
+    }
+}
+
+//! Tells whether the chunk candidate at `blknum`, if any, can be chunk
+//! `index` of the region with the given sector count.
+bool fits_entry(std::span<const CandidateRecord> candidates,
+                const RegionAssembly &region, uint64_t blknum, uint32_t index,
+                uint32_t count) {
+    auto rec = std::lower_bound(candidates.begin(), candidates.end(), blknum,
+                                [](const CandidateRecord &r, uint64_t blk) {
+                                    return r.blknum < blk;
+                                });
+    if (rec == candidates.end() || rec->blknum != blknum ||
+        !(rec->types & SECTOR_CHUNK) ||
+        chunk_sectors(rec->chunk_length) != count) {
+        return false;
+    }
+    if (rec->types & SECTOR_CHUNK_COORDS) {
+        if (chunk_index(rec->x_pos, rec->z_pos) != index) {
+            return false;
+        }
+        if (region.located &&
+            (chunk_region(rec->x_pos) != region.region_x ||
+             chunk_region(rec->z_pos) != region.region_z)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+//! Anchors the chunks still missing where a chunk candidate lies in line
+//! with the anchor before or after them.  Runs of unlocated chunks grow
+//! forward from the header this way.
+void anchor_in_line(const RegionAssembly &region,
+                    std::span<const CandidateRecord> candidates,
+                    std::vector<Anchor> &anchors) {
+    std::sort(anchors.begin(), anchors.end());
+
+    std::vector<std::pair<uint32_t, uint32_t>> entries; // sector, index
+    for (uint32_t i = 0; i < REGION_CHUNKS; ++i) {
+        const uint32_t entry = region.offsets[i];
+        if (entry_count(entry) > 0 &&
+            !is_anchored(anchors, entry_sector(entry))) {
+            entries.emplace_back(entry_sector(entry), i);
+        }
+    }
+    std::sort(entries.begin(), entries.end());
+
+    const std::size_t strong = anchors.size();
+    std::size_t next = 0;
+    int64_t prev_delta = 0;
+    bool has_prev = false;
+    for (auto [sector, index] : entries) {
+        while (next < strong && anchors[next].sector < sector) {
+            prev_delta = anchors[next++].delta();
+            has_prev = true;
+        }
+        const uint32_t count = entry_count(region.offsets[index]);
+        for (int side = 0; side < 2; ++side) {
+            int64_t delta;
+            if (side == 0 && has_prev) {
+                delta = prev_delta;
+            } else if (side == 1 && next < strong) {
+                delta = anchors[next].delta();
+            } else {
+                continue;
+            }
+            const int64_t blknum = delta + sector;
+            if (blknum >= 0 &&
+                fits_entry(candidates, region, blknum, index, count)) {
+                anchors.push_back({sector, count, uint64_t(blknum)});
+                prev_delta = delta;
+                has_prev = true;
+                break;
+            }
+        }
+    }
+}
+
+//! Anchors the later fragments of the chunks that continue elsewhere, where
+//! a single block was found to continue them.
+void anchor_continuations(std::span<const Continuation> continuations,
+                          std::vector<Anchor> &anchors) {
+    const std::size_t count = anchors.size();
+    for (std::size_t i = 0; i < count; ++i) {
+        const Anchor chunk = anchors[i];
+        auto it = std::lower_bound(continuations.begin(), continuations.end(),
+                                   chunk.blknum,
+                                   [](const Continuation &c, uint64_t blk) {
+                                       return c.chunk_blk < blk;
+                                   });
+        while (it != continuations.end() && it->chunk_blk == chunk.blknum) {
+            // A position that more than one block continues is left open.
+            auto next = it + 1;
+            while (next != continuations.end() &&
+                   next->chunk_blk == it->chunk_blk &&
+                   next->position == it->position) {
+                ++next;
+            }
+            if (next - it == 1 && it->position < chunk.length) {
+                anchors.push_back({chunk.sector + it->position,
+                                   chunk.length - it->position, it->next_blk});
+            }
+            it = next;
+        }
+    }
+}
+
+//! Merges anchors sharing a delta into extents.  An anchor with a new delta
+//! cuts short the extent before it.
+std::vector<RegionExtent> chain_extents(std::vector<Anchor> &anchors) {
+    std::sort(anchors.begin(), anchors.end());
+    std::vector<RegionExtent> extents;
+    int64_t delta = 0;
+    for (const auto &a : anchors) {
+        if (!extents.empty() && a.delta() == delta) {
+            auto &last = extents.back();
+            last.length = std::max(last.end(), a.sector + a.length) -
+                          last.sector;
+            continue;
+        }
+        if (!extents.empty() && extents.back().end() > a.sector) {
+            auto &last = extents.back();
+            last.length = a.sector - last.sector;
+            if (last.length == 0) {
+                extents.pop_back();
+            }
+        }
+        extents.push_back({a.sector, a.length, a.blknum});
+        delta = a.delta();
+    }
+    return extents;
+}
+
+} // namespace
+
+bool RegionAssembly::has_chunk(std::size_t i) const {
+    const uint32_t count = entry_count(offsets[i]);
+    if (count == 0) {
+        return false;
+    }
+    uint32_t sector = entry_sector(offsets[i]);
+    const uint32_t end = sector + count;
+    auto it = std::upper_bound(extents.begin(), extents.end(), sector,
+                               [](uint32_t s, const RegionExtent &e) {
+                                   return s < e.sector;
+                               });
+    if (it == extents.begin()) {
+        return false;
+    }
+    for (--it; it != extents.end() && it->sector <= sector; ++it) {
+        sector = std::max(sector, it->end());
+        if (sector >= end) {
+            return true;
+        }
+    }
+    return false;
+}
+
+uint64_t RegionAssembly::block_of(uint32_t sector) const {
+    auto it = std::upper_bound(extents.begin(), extents.end(), sector,
+                               [](uint32_t s, const RegionExtent &e) {
+                                   return s < e.sector;
+                               });
+    if (it == extents.begin() || (--it)->end() <= sector) {
+        return UINT64_MAX;
+    }
+    return it->blknum + (sector - it->sector);
+}
+
+Reassembly reassemble_regions(std::span<const CandidateRecord> candidates,
+                              const HeaderMatches &headers,
+                              BlockReader &reader,
+                              std::span<const Continuation> continuations) {
+    Reassembly result;
+    auto &regions = result.regions;
+    for (const auto &pair : headers.pairs) {
+        regions.push_back(read_header(reader, pair.offsets_blk));
+        regions.back().timestamps_blk = pair.timestamps_blk;
+        regions.back().has_timestamps = true;
+    }
+    for (const auto &collision : headers.collisions) {
+        for (uint64_t blk : collision.offsets_blks) {
+            regions.push_back(read_header(reader, blk));
+        }
+    }
+    for (uint64_t blk : headers.unmatched_offsets) {
+        regions.push_back(read_header(reader, blk));
+    }
+    std::sort(regions.begin(), regions.end(),
+              [](const RegionAssembly &a, const RegionAssembly &b) {
+                  return a.offsets_blk < b.offsets_blk;
+              });
+
+    // Index the chunks with coordinates by (region, chunk index).
+    std::vector<LocatedChunk> located;
+    for (const auto &rec : candidates) {
+        if (rec.types & SECTOR_CHUNK_COORDS) {
+            located.push_back({region_key(chunk_region(rec.x_pos),
+                                          chunk_region(rec.z_pos)),
+                               chunk_index(rec.x_pos, rec.z_pos),
+                               chunk_sectors(rec.chunk_length), rec.blknum});
+        }
+    }
+    std::sort(located.begin(), located.end());
+    std::vector<RegionChunks> by_region;
+    for (auto it = located.begin(); it != located.end();) {
+        auto end = std::find_if(it, located.end(), [&](const LocatedChunk &c) {
+            return c.region != it->region;
+        });
+        by_region.push_back({it->region, {it, end}});
+        it = end;
+    }
+
+    std::vector<Continuation> sorted_continuations(continuations.begin(),
+                                                   continuations.end());
+    std::sort(sorted_continuations.begin(), sorted_continuations.end(),
+              [](const Continuation &a, const Continuation &b) {
+                  return std::tie(a.chunk_blk, a.position) <
+                         std::tie(b.chunk_blk, b.position);
+              });
+
+    std::vector<SequencePlacement> placements(regions.size());
+    result.shared_sequences = place_by_sequence(regions, candidates,
+                                                placements, result.collisions);
+
+    std::vector<Anchor> anchors;
+    for (std::size_t t = 0; t < regions.size(); ++t) {
+        auto &region = regions[t];
+        auto &placement = placements[t];
+        region.sequences_placed = placement.regions.size();
+        if (!placement.regions.empty()) {
+            locate_by_sequence(region, placement.regions);
+        } else {
+            locate(region, by_region);
+        }
+
+        anchors = std::move(placement.anchors);
+        std::sort(anchors.begin(), anchors.end());
+        anchors.erase(std::unique(anchors.begin(), anchors.end(),
+                                  [](const Anchor &a, const Anchor &b) {
+                                      return a.sector == b.sector &&
+                                             a.blknum == b.blknum;
+                                  }),
+                      anchors.end());
+        anchors.push_back({0, 1, region.offsets_blk});
+        if (region.has_timestamps) {
+            anchors.push_back({1, 1, region.timestamps_blk});
+        }
+        if (region.located) {
+            const uint64_t key = region_key(region.region_x, region.region_z);
+            auto owner = std::lower_bound(
+                by_region.begin(), by_region.end(), key,
+                [](const RegionChunks &c, uint64_t k) { return c.region < k; });
+            anchor_located(region, *owner, anchors);
+        }
+        anchor_in_line(region, candidates, anchors);
+        anchor_continuations(sorted_continuations, anchors);
+        region.extents = chain_extents(anchors);
+
+        for (std::size_t i = 0; i < REGION_CHUNKS; ++i) {
+            if (region.has_chunk(i)) {
+                ++region.chunks_found;
+            }
+        }
+    }
+    return result;
+}
+
+} // namespace mcarve
@@ -0,0 +1,114 @@
+#ifndef REASSEMBLE_H_
+#define REASSEMBLE_H_
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "BlockReader.hpp"
+#include "candidates.hpp"
+#include "chunk_sequence.hpp"
+#include "continuation.hpp"
+#include "header_match.hpp"
+
+namespace mcarve {
+
+//! Sectors of a region file, and so the chunk index space, per region.
+inline constexpr std::size_t REGION_CHUNKS = 1024;
+
+//! Region coordinates of a chunk.
+inline int32_t chunk_region(int32_t pos) { return pos >> 5; }
+
+//! Index of a chunk within the offset table of its region file.
+inline uint32_t chunk_index(int32_t x_pos, int32_t z_pos) {
+    return (x_pos & 31) + 32 * (z_pos & 31);
+}
+
+//! Number of sectors a region file allots to a chunk whose length word is
+//! `chunk_length`.
+inline uint32_t chunk_sectors(uint32_t chunk_length) {
+    return (chunk_length + 4 + BLOCKSIZE - 1) / BLOCKSIZE;
+}
+
+//! A run of consecutive region file sectors stored in consecutive blocks.
+struct RegionExtent {
+    uint32_t sector; //!< First sector within the region file.
+    uint32_t length; //!< Number of sectors.
+    uint64_t blknum; //!< Block holding the first sector.
+
+    uint32_t end() const { return sector + length; }
+};
+
+//! A region file pieced together from its header and the chunk candidates.
+struct RegionAssembly {
+    uint64_t offsets_blk;
+    //! Block of the paired timestamp table, when has_timestamps.
+    uint64_t timestamps_blk;
+    bool has_timestamps;
+
+    //! The chunks named a single region whose chunks fit the offset table
+    //! best.  Otherwise the extents come from the header's position alone.
+    bool located;
+    int32_t region_x;
+    int32_t region_z;
+    //! Number of other regions that fit the offset table equally well.
+    uint32_t rivals;
+
+    //! Decoded offset table: entry i is sector << 8 | sector count.
+    std::array<uint32_t, REGION_CHUNKS> offsets;
+    //! The fragment chain, sorted by sector.  Sectors not covered are
+    //! unresolved.
+    std::vector<RegionExtent> extents;
+
+    uint32_t chunks_present; //!< Chunks listed in the offset table.
+    uint32_t chunks_found;   //!< Chunks whose sectors are all covered.
+    //! Four-chunk sequences on disk that were placed in this table.
+    uint32_t sequences_placed;
+
+    //! Tells whether all sectors of chunk i are covered by the extents.
+    bool has_chunk(std::size_t i) const;
+    //! Returns the block holding the given sector, or UINT64_MAX.
+    uint64_t block_of(uint32_t sector) const;
+};
+
+//! A four-chunk sequence on disk found in more than one offset table.  It
+//! is left unplaced.
+struct SequenceCollision {
+    uint64_t chunk_blk; //!< Block of the first chunk of the sequence.
+    ChunkSequence sequence;
+    std::vector<uint64_t> offsets_blks;
+};
+
+struct Reassembly {
+    //! Sorted by offset table block.
+    std::vector<RegionAssembly> regions;
+    //! In block order.
+    std::vector<SequenceCollision> collisions;
+    //! Distinct four-chunk sequences listed by more than one offset table,
+    //! whether or not they turned up on disk.
+    std::size_t shared_sequences = 0;
+};
+
+//! Pass 2 and 3: pieces region files together from the pass 1 candidates.
+//!
+//! Every offset table found is read and decoded, and its four-chunk
+//! sequences go into a ChunkSequenceIndex.  Each run of four chunks with
+//! coordinates on disk is looked up there, which anchors the fragment in
+//! its table and names the table's region.  Tables that no sequence reaches
+//! are assigned the region whose chunks fit their entries best, with the
+//! chunk candidates indexed by (region, chunk index).  Each chunk of the
+//! region is then anchored at the sector the table gives it, and so are
+//! chunk candidates without coordinates that lie in line with an anchor
+//! before or after them.  Anchors sharing the same block-to-sector delta are
+//! merged into extents, an anchor overriding the tail of the extent before
+//! it.  Continuations found by ContinuationMatcher anchor the later
+//! fragments of fragmented chunks.
+Reassembly reassemble_regions(std::span<const CandidateRecord> candidates,
+                              const HeaderMatches &headers,
+                              BlockReader &reader,
+                              std::span<const Continuation> continuations = {});
+
+} // namespace mcarve
+
+#endif // REASSEMBLE_H_
@@ -0,0 +1,213 @@
+// region_writer.cpp
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+
+#include "region_writer.hpp"
+
+namespace mcarve {
+
+namespace {
+
+// The offset and timestamp tables take the first two sectors.
+constexpr uint32_t HEADER_SECTORS = 2;
+
+// Blocks per buffered copy.
+constexpr uint64_t BUFFERED_RUN = 256;
+
+//! Tells whether a failed kernel copy should be retried another way, as
+//! opposed to being a real I/O error.
+bool falls_back(int err) {
+    return err == EXDEV || err == ENOSYS || err == EOPNOTSUPP ||
+           err == EINVAL;
+}
+
+void write_all(int fd, const unsigned char *data, std::size_t size,
+               uint64_t offset) {
+    while (size > 0) {
+        ssize_t n = pwrite(fd, data, size, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            throw std::runtime_error(std::string("Failed to write region: ") +
+                                     strerror(errno));
+        }
+        data += n;
+        size -= n;
+        offset += n;
+    }
+}
+
+} // namespace
+
+RegionWriter::RegionWriter(const std::string &image, BlockReader &reader)
+    : m_reader(reader) {
+    m_image_fd = open(image.c_str(), O_RDONLY);
+    if (m_image_fd == -1) {
+        throw std::runtime_error("Failed to open file: " + image);
+    }
+}
+
+RegionWriter::~RegionWriter() { close(m_image_fd); }
+
+void RegionWriter::write(const RegionAssembly &region,
+                         const std::string &filename) {
+    // Regenerate the header from the chunks that are complete.
+    BlockBuffer offsets{};
+    BlockBuffer timestamps{};
+    BlockBuffer scratch;
+    std::span<const unsigned char> found_timestamps;
+    if (region.has_timestamps) {
+        found_timestamps = m_reader.view_block(region.timestamps_blk, scratch);
+    }
+    uint32_t end = HEADER_SECTORS;
+    std::vector<bool> wanted;
+    for (std::size_t i = 0; i < REGION_CHUNKS; ++i) {
+        const uint32_t entry = region.offsets[i];
+        if ((entry & 0xff) == 0) {
+            continue;
+        }
+        if (!region.has_chunk(i)) {
+            ++m_stats.chunks_dropped;
+            continue;
+        }
+        const uint32_t word = __builtin_bswap32(entry);
+        memcpy(offsets.data() + 4 * i, &word, sizeof(word));
+        if (region.has_timestamps) {
+            memcpy(timestamps.data() + 4 * i, found_timestamps.data() + 4 * i,
+                   4);
+        }
+        const uint32_t first = entry >> 8;
+        const uint32_t last = first + (entry & 0xff);
+        end = std::max(end, last);
+        if (wanted.size() < last) {
+            wanted.resize(last);
+        }
+        std::fill(wanted.begin() + first, wanted.begin() + last, true);
+    }
+
+    int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        throw std::runtime_error("Failed to create region file: " + filename);
+    }
+    try {
+        // Sectors of dropped chunks and unused space read back as zeros.
+        if (ftruncate(fd, off_t{end} * BLOCKSIZE) != 0) {
+            throw std::runtime_error("Failed to size region file: " +
+                                     filename);
+        }
+        write_all(fd, offsets.data(), BLOCKSIZE, 0);
+        write_all(fd, timestamps.data(), BLOCKSIZE, BLOCKSIZE);
+        m_stats.bytes_buffered += 2 * BLOCKSIZE;
+
+        // Copy the runs of wanted sectors within each extent.
+        for (const auto &extent : region.extents) {
+            const uint32_t stop =
+                std::min<uint32_t>(extent.end(), wanted.size());
+            uint32_t s = std::max(extent.sector, HEADER_SECTORS);
+            while (s < stop) {
+                if (!wanted[s]) {
+                    ++s;
+                    continue;
+                }
+                uint32_t run_end = s;
+                while (run_end < stop && wanted[run_end]) {
+                    ++run_end;
+                }
+                copy_blocks(fd, s, extent.blknum + (s - extent.sector),
+                            run_end - s);
+                s = run_end;
+            }
+        }
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+    if (close(fd) != 0) {
+        throw std::runtime_error("Failed to write region file: " + filename);
+    }
+    ++m_stats.files;
+}
+
+void RegionWriter::copy_blocks(int out_fd, uint64_t sector, uint64_t blknum,
+                               uint64_t count) {
+    loff_t in = blknum * BLOCKSIZE;
+    loff_t out = sector * BLOCKSIZE;
+    uint64_t remaining = count * BLOCKSIZE;
+
+    while (remaining > 0 && m_use_copy_file_range) {
+        ssize_t n = copy_file_range(m_image_fd, &in, out_fd, &out, remaining,
+                                    0);
+        if (n > 0) {
+            remaining -= n;
+            m_stats.bytes_copied += n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && falls_back(errno)) {
+            m_use_copy_file_range = false;
+        } else {
+            throw std::runtime_error("Failed to copy block " +
+                                     std::to_string(in / BLOCKSIZE));
+        }
+    }
+
+    while (remaining > 0 && m_use_sendfile) {
+        // sendfile() writes at the file position of the output.
+        if (lseek(out_fd, out, SEEK_SET) < 0) {
+            throw std::runtime_error("Failed to seek in region file");
+        }
+        off_t pos = in;
+        ssize_t n = sendfile(out_fd, m_image_fd, &pos, remaining);
+        if (n > 0) {
+            in += n;
+            out += n;
+            remaining -= n;
+            m_stats.bytes_copied += n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && falls_back(errno)) {
+            m_use_sendfile = false;
+        } else {
+            throw std::runtime_error("Failed to copy block " +
+                                     std::to_string(in / BLOCKSIZE));
+        }
+    }
+
+    if (remaining > 0) {
+        // Finish with buffered copies from the last whole block copied.
+        const uint64_t done = count - (remaining + BLOCKSIZE - 1) / BLOCKSIZE;
+        copy_buffered(out_fd, sector + done, blknum + done, count - done);
+    }
+}
+
+void RegionWriter::copy_buffered(int out_fd, uint64_t sector,
+                                 uint64_t blknum, uint64_t count) {
+    std::vector<unsigned char> buf(std::min(count, BUFFERED_RUN) * BLOCKSIZE);
+    while (count > 0) {
+        const uint64_t n = std::min(count, BUFFERED_RUN);
+        auto data = m_reader.view_blocks(blknum, n, buf);
+        write_all(out_fd, data.data(), data.size(), sector * BLOCKSIZE);
+        m_stats.bytes_buffered += data.size();
+        sector += n;
+        blknum += n;
+        count -= n;
+    }
+}
+
+std::string region_filename(const RegionAssembly &region) {
+    if (region.located) {
+        return "r." + std::to_string(region.region_x) + "." +
+               std::to_string(region.region_z) + ".mca";
+    }
+    return "unlocated." + std::to_string(region.offsets_blk) + ".mca";
+}
+
+} // namespace mcarve
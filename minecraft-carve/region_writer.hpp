@@ -0,0 +1,64 @@
+#ifndef REGION_WRITER_H_
+#define REGION_WRITER_H_
+
+#include <cstdint>
+#include <string>
+
+#include "BlockReader.hpp"
+#include "reassemble.hpp"
+
+namespace mcarve {
+
+struct RegionWriteStats {
+    uint64_t files = 0;
+    //! Bytes moved in the kernel by copy_file_range() or sendfile().
+    uint64_t bytes_copied = 0;
+    //! Bytes read into memory and written from there.
+    uint64_t bytes_buffered = 0;
+    //! Listed chunks left out because not all their sectors were found.
+    uint64_t chunks_dropped = 0;
+};
+
+//! Pass 3: writes reassembled region files.
+//!
+//! The chunk sectors are gathered from the image file with
+//! copy_file_range(), so that the data never passes through user space.
+//! Where the kernel or filesystem cannot do that, sendfile() is tried next,
+//! and then buffered copies through the BlockReader.  The two header sectors
+//! are regenerated: the entries of chunks that were not found in full are
+//! cleared, so the game sees them as absent rather than corrupt.  A missing
+//! timestamp table is written as zeros.
+class RegionWriter {
+  public:
+    //! Copies from `image`, the file that `reader` reads.  Block n of the
+    //! reader must lie at byte offset n * BLOCKSIZE of the file.
+    RegionWriter(const std::string &image, BlockReader &reader);
+    ~RegionWriter();
+    RegionWriter(const RegionWriter &) = delete;
+    RegionWriter &operator=(const RegionWriter &) = delete;
+
+    //! Writes a region file, replacing any file of that name.
+    void write(const RegionAssembly &region, const std::string &filename);
+
+    const RegionWriteStats &stats() const { return m_stats; }
+
+  private:
+    void copy_blocks(int out_fd, uint64_t sector, uint64_t blknum,
+                     uint64_t count);
+    void copy_buffered(int out_fd, uint64_t sector, uint64_t blknum,
+                       uint64_t count);
+
+    int m_image_fd;
+    BlockReader &m_reader;
+    bool m_use_copy_file_range = true;
+    bool m_use_sendfile = true;
+    RegionWriteStats m_stats;
+};
+
+//! Returns the conventional file name of a located region, r.X.Z.mca, or a
+//! name made from the offset table block otherwise.
+std::string region_filename(const RegionAssembly &region);
+
+} // namespace mcarve
+
+#endif // REGION_WRITER_H_
@@ -0,0 +1,214 @@
+// scan_plan.cpp
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include "candidates.hpp"
+#include "scan_plan.hpp"
+#include "scanner.hpp"
+
+namespace mcarve {
+
+namespace {
+
+constexpr uint32_t SCAN_PLAN_VERSION = 1;
+
+} // namespace
+
+std::vector<BlockExtent> ScanPlan::unit_ranges(std::size_t i) const {
+    const PlanUnit &unit = units.at(i);
+    std::vector<BlockExtent> clipped;
+    for (const auto &range : ranges) {
+        const uint64_t start = std::max(range.start, unit.start);
+        const uint64_t end = std::min(range.end(), unit.end);
+        if (start < end) {
+            clipped.push_back({start, end - start});
+        }
+    }
+    return clipped;
+}
+
+void split_scan_plan(ScanPlan &plan, std::span<const BlockExtent> extents,
+                     std::size_t count) {
+    if (count == 0 || plan.shard_blocks == 0) {
+        throw std::runtime_error("A plan needs units and shards");
+    }
+    uint64_t total = 0;
+    for (const auto &extent : extents) {
+        total += extent.length;
+    }
+    const uint64_t shards = (total + plan.shard_blocks - 1) / plan.shard_blocks;
+    const uint64_t first = plan.ranges.empty() ? 0 : plan.ranges.front().start;
+    const uint64_t last = plan.ranges.empty() ? 0 : plan.ranges.back().end();
+
+    // Unit k begins with shard k * shards / count.  The boundaries are
+    // found in one walk over the extents, as they only grow.
+    std::vector<uint64_t> bounds{first};
+    std::vector<uint64_t> offsets{0};
+    std::size_t e = 0;
+    uint64_t before = 0; // Blocks of the extents ahead of extents[e].
+    for (std::size_t k = 1; k < count; ++k) {
+        const uint64_t offset =
+            std::min(total, k * shards / count * plan.shard_blocks);
+        while (e < extents.size() && before + extents[e].length <= offset) {
+            before += extents[e++].length;
+        }
+        bounds.push_back(e < extents.size()
+                             ? extents[e].start + (offset - before)
+                             : last);
+        offsets.push_back(offset);
+    }
+    bounds.push_back(last);
+    offsets.push_back(total);
+
+    plan.units.clear();
+    for (std::size_t k = 0; k < count; ++k) {
+        plan.units.push_back(
+            {bounds[k], bounds[k + 1], offsets[k + 1] - offsets[k]});
+    }
+}
+
+void save_scan_plan(const std::string &filename, const ScanPlan &plan) {
+    std::ofstream out(filename);
+    out << "# mcarve scan plan: ranges and units are [start, end) blocks\n"
+        << "version " << SCAN_PLAN_VERSION << "\n"
+        << "blocks_count " << plan.blocks_count << "\n"
+        << "shard_blocks " << plan.shard_blocks << "\n"
+        << "min_time " << plan.min_time << "\n"
+        << "max_time " << plan.max_time << "\n"
+        << "validate " << plan.validate_chunks << "\n";
+    for (const auto &range : plan.ranges) {
+        out << "range " << range.start << " " << range.end() << "\n";
+    }
+    for (const auto &unit : plan.units) {
+        out << "unit " << unit.start << " " << unit.end << " " << unit.blocks
+            << "\n";
+    }
+    if (!out.flush()) {
+        throw std::runtime_error("Failed to write scan plan: " + filename);
+    }
+}
+
+ScanPlan load_scan_plan(const std::string &filename) {
+    std::ifstream in(filename);
+    if (!in) {
+        throw std::runtime_error("Cannot open scan plan: " + filename);
+    }
+    ScanPlan plan;
+    uint32_t version = 0;
+    std::string line;
+    for (unsigned number = 1; std::getline(in, line); ++number) {
+        std::istringstream fields(line);
+        std::string key;
+        if (!(fields >> key) || key[0] == '#') {
+            continue;
+        }
+        bool ok = true;
+        if (key == "version") {
+            ok = bool(fields >> version);
+        } else if (key == "blocks_count") {
+            ok = bool(fields >> plan.blocks_count);
+        } else if (key == "shard_blocks") {
+            ok = bool(fields >> plan.shard_blocks);
+        } else if (key == "min_time") {
+            ok = bool(fields >> plan.min_time);
+        } else if (key == "max_time") {
+            ok = bool(fields >> plan.max_time);
+        } else if (key == "validate") {
+            ok = bool(fields >> plan.validate_chunks);
+        } else if (key == "range") {
+            uint64_t start, end;
+            ok = fields >> start >> end && start < end;
+            plan.ranges.push_back({start, end - start});
+        } else if (key == "unit") {
+            PlanUnit unit;
+            ok = fields >> unit.start >> unit.end >> unit.blocks &&
+                 unit.start <= unit.end;
+            plan.units.push_back(unit);
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            throw std::runtime_error(filename + ":" + std::to_string(number) +
+                                     ": bad scan plan line: " + line);
+        }
+    }
+    if (version != SCAN_PLAN_VERSION || plan.units.empty() ||
+        plan.shard_blocks == 0) {
+        throw std::runtime_error("Not a valid scan plan: " + filename);
+    }
+    return plan;
+}
+
+uint64_t unit_extent_end(BlockReader &reader, const ScanPlan &plan,
+                         std::size_t i, std::span<const BlockExtent> extents) {
+    const PlanUnit &unit = plan.units.at(i);
+    uint64_t blocks = 0;
+    for (const auto &extent : extents) {
+        blocks += extent.length;
+    }
+    if (blocks != unit.blocks) {
+        throw std::runtime_error(
+            "Unit " + std::to_string(i) + " has " + std::to_string(blocks) +
+            " blocks to scan in this image, but " +
+            std::to_string(unit.blocks) + " in the planned one");
+    }
+    if (extents.empty() || extents.back().end() != unit.end) {
+        return 0;
+    }
+    // Only the blocks that a chunk near the end can claim matter.
+    for (const auto &range : plan.ranges) {
+        if (range.start < unit.end && unit.end < range.end()) {
+            const auto more = reader.scan_extents(
+                unit.end, std::min(range.end(), unit.end + MAX_CHUNK_WINDOW));
+            if (!more.empty() && more.front().start == unit.end) {
+                return more.front().end();
+            }
+        }
+    }
+    return 0;
+}
+
+void merge_scan_indexes(const ScanPlan &plan,
+                        std::span<const std::string> parts,
+                        const std::string &output) {
+    if (parts.size() != plan.units.size()) {
+        throw std::runtime_error(
+            "The plan has " + std::to_string(plan.units.size()) +
+            " units, but " + std::to_string(parts.size()) +
+            " partial indexes were given");
+    }
+    CandidateIndexWriter merged(output, plan.min_time, plan.max_time);
+    for (std::size_t i = 0; i < parts.size(); ++i) {
+        CandidateIndex part(parts[i]);
+        const auto &header = part.header();
+        const auto records = part.records();
+        const PlanUnit &unit = plan.units[i];
+        // A worker that died leaves a part that looks like an index with
+        // fewer records, or none.
+        if (!(header.flags & CANDIDATE_INDEX_FINISHED) ||
+            std::filesystem::file_size(parts[i]) !=
+                sizeof(header) + records.size() * sizeof(CandidateRecord)) {
+            throw std::runtime_error(parts[i] +
+                                     " is unfinished; scan its unit again");
+        }
+        if (header.min_time != plan.min_time ||
+            header.max_time != plan.max_time) {
+            throw std::runtime_error(parts[i] +
+                                     " was scanned with other timestamps "
+                                     "than the plan's");
+        }
+        if (!records.empty() && (records.front().blknum < unit.start ||
+                                 records.back().blknum >= unit.end)) {
+            throw std::runtime_error(parts[i] + " is not of unit " +
+                                     std::to_string(i));
+        }
+        merged.append(records);
+    }
+    merged.close();
+}
+
+} // namespace mcarve
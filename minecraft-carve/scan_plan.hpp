@@ -0,0 +1,78 @@
+#ifndef SCAN_PLAN_H_
+#define SCAN_PLAN_H_
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "BlockReader.hpp"
+#include "extent.hpp"
+
+namespace mcarve {
+
+//! A part of a distributed scan: the blocks [start, end) of the plan's
+//! ranges, holding `blocks` blocks to scan.
+struct PlanUnit {
+    uint64_t start;
+    uint64_t end;
+    uint64_t blocks;
+};
+
+//! A scan split into units that separate hosts can run, each on its own
+//! copy of the image, and whose partial indexes merge into the index of a
+//! single-host run.
+//!
+//! The settings that decide which candidates are found are fixed by the
+//! plan.  Units are cut at the shard boundaries of a single-host scan of
+//! the same extents.  A worker validates the chunks near the end of its
+//! unit over the rest of their extent, as found by unit_extent_end(), so
+//! the merged index is the one that a single-host scan writes, for any
+//! thread count.
+struct ScanPlan {
+    //! Blocks of the image, to tell a different image from the one planned.
+    uint64_t blocks_count = 0;
+    uint64_t shard_blocks = 0;
+    uint32_t min_time = 0;
+    uint32_t max_time = 0;
+    bool validate_chunks = false;
+    //! Sorted block ranges of the scan.
+    std::vector<BlockExtent> ranges;
+    std::vector<PlanUnit> units;
+
+    //! Returns the part of the ranges that unit i covers.
+    std::vector<BlockExtent> unit_ranges(std::size_t i) const;
+};
+
+//! Splits the extents that a scan of plan.ranges would classify, as found
+//! by find_scan_extents(), into `count` units with about equal numbers of
+//! blocks.  Units are made of whole shards of plan.shard_blocks, so some
+//! may be empty when there are fewer shards than units.
+void split_scan_plan(ScanPlan &plan, std::span<const BlockExtent> extents,
+                     std::size_t count);
+
+//! Writes a plan as text, one setting or unit per line.
+void save_scan_plan(const std::string &filename, const ScanPlan &plan);
+
+ScanPlan load_scan_plan(const std::string &filename);
+
+//! Given the extents that a worker found for unit i, checks that they hold
+//! the unit's number of blocks, which tells a copy of the image with other
+//! free space or holes.  Returns the end of the extent that the last of
+//! them was cut from at the end of the unit, as ScanOptions::last_extent_end
+//! wants it, or zero if it was not cut.
+uint64_t unit_extent_end(BlockReader &reader, const ScanPlan &plan,
+                         std::size_t i, std::span<const BlockExtent> extents);
+
+//! Writes the index of the whole scan from the partial indexes of its
+//! units, given in unit order.  Each must be finished, and hold candidates
+//! of its own unit only, found with the plan's timestamp range.  The
+//! result is the index that a single-host scan with the plan's settings
+//! writes.
+void merge_scan_indexes(const ScanPlan &plan,
+                        std::span<const std::string> parts,
+                        const std::string &output);
+
+} // namespace mcarve
+
+#endif // SCAN_PLAN_H_
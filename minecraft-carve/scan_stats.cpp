@@ -0,0 +1,153 @@
+// scan_stats.cpp
+
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+
+#include "BlockReader.hpp"
+#include "scan_stats.hpp"
+
+namespace mcarve {
+
+namespace {
+
+double seconds(uint64_t ns) { return ns * 1e-9; }
+
+double rate(double count, double secs) { return secs > 0 ? count / secs : 0; }
+
+double mib(uint64_t blocks) { return blocks * (BLOCKSIZE / 1048576.0); }
+
+uint64_t get(const std::atomic<uint64_t> &counter) {
+    return counter.load(std::memory_order_relaxed);
+}
+
+//! Writes "name":{"busy_s":..,"<unit>":..,"<unit>_per_s":..} for a stage,
+//! with MiB/s for stages that move blocks.
+void stage_json(std::ostream &out, const char *name, const char *unit,
+                uint64_t count, uint64_t ns, bool blocks) {
+    const double busy = seconds(ns);
+    out << "\"" << name << "\":{\"busy_s\":" << busy << ",\"" << unit
+        << "\":" << count << ",\"" << unit
+        << "_per_s\":" << rate(count, busy);
+    if (blocks) {
+        out << ",\"mib_per_s\":" << rate(mib(count), busy);
+    }
+    out << "}";
+}
+
+} // namespace
+
+ScanStatsReporter::ScanStatsReporter(const ScanStats &stats,
+                                     const std::string &filename,
+                                     std::chrono::milliseconds interval)
+    : m_stats(stats), m_out(filename, std::ios::app), m_interval(interval),
+      m_start(Clock::now()), m_last(m_start) {
+    if (!m_out.is_open()) {
+        throw std::runtime_error("Failed to open stats output: " + filename);
+    }
+    if (m_interval.count() > 0) {
+        m_thread = std::thread([this] { run(); });
+    }
+}
+
+ScanStatsReporter::~ScanStatsReporter() {
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_stop = true;
+        m_cv.notify_all();
+    }
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+void ScanStatsReporter::finish() {
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_stop = true;
+        m_cv.notify_all();
+    }
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+    write_line(true);
+}
+
+void ScanStatsReporter::run() {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    while (!m_cv.wait_for(lock, m_interval, [&] { return m_stop; })) {
+        write_line(false);
+    }
+}
+
+void ScanStatsReporter::write_line(bool final) {
+    const auto now = Clock::now();
+    const double elapsed = std::chrono::duration<double>(now - m_start).count();
+    const double since = std::chrono::duration<double>(now - m_last).count();
+    const uint64_t blocks = get(m_stats.blocks_read);
+    const uint64_t recent = blocks - m_last_blocks;
+    m_last = now;
+    m_last_blocks = blocks;
+
+    std::ostringstream line;
+    line << std::fixed << std::setprecision(6);
+    line << "{\"elapsed_s\":" << elapsed
+         << ",\"final\":" << (final ? "true" : "false")
+         << ",\"range_blocks\":" << get(m_stats.range_blocks)
+         << ",\"extent_blocks\":" << get(m_stats.extent_blocks)
+         << ",\"blocks_read\":" << blocks
+         << ",\"zero_blocks\":" << get(m_stats.zero_blocks)
+         << ",\"blocks_per_s\":" << rate(blocks, elapsed)
+         << ",\"mib_per_s\":" << rate(mib(blocks), elapsed)
+         << ",\"recent_blocks_per_s\":" << rate(recent, since)
+         << ",\"recent_mib_per_s\":" << rate(mib(recent), since)
+         << ",\"candidates\":" << get(m_stats.candidates) << ",\"stages\":{";
+    stage_json(line, "allocation_filter", "blocks", get(m_stats.range_blocks),
+               get(m_stats.extents_ns), true);
+    line << ",";
+    stage_json(line, "read", "blocks", blocks, get(m_stats.read_ns), true);
+    line << ",";
+    stage_json(line, "classify", "blocks", blocks, get(m_stats.classify_ns),
+               true);
+    line << ",";
+    stage_json(line, "validate", "chunks", get(m_stats.validated),
+               get(m_stats.validate_ns), false);
+    line << "},\"accepted\":{\"timestamps\":" << get(m_stats.timestamps)
+         << ",\"offsets\":" << get(m_stats.offsets)
+         << ",\"chunks\":" << get(m_stats.chunks)
+         << ",\"chunks_valid\":" << get(m_stats.chunks_valid)
+         << ",\"chunks_rejected\":" << get(m_stats.chunks_rejected)
+         << ",\"chunks_coords\":" << get(m_stats.chunks_coords)
+         << "},\"shards_in_flight\":"
+         << get(m_stats.shards_started) - get(m_stats.shards_done) << "}\n";
+    m_out << line.str() << std::flush;
+}
+
+void print_scan_stats(std::ostream &out, const ScanStats &stats,
+                      double secs) {
+    const uint64_t blocks = get(stats.blocks_read);
+    const auto flags = out.flags();
+    const auto precision = out.precision();
+    out << std::fixed << std::setprecision(1);
+    out << blocks << " of " << get(stats.range_blocks)
+        << " blocks scanned in " << secs << " s (" << rate(mib(blocks), secs)
+        << " MiB/s), " << get(stats.zero_blocks) << " of them zeros\n";
+    out << "  allocation filter " << seconds(get(stats.extents_ns))
+        << " s, read " << seconds(get(stats.read_ns)) << " s, classify "
+        << seconds(get(stats.classify_ns)) << " s, validate "
+        << seconds(get(stats.validate_ns)) << " s (summed over threads)\n";
+    out << "  accepted: " << get(stats.timestamps) << " timestamps, "
+        << get(stats.offsets) << " offsets, " << get(stats.chunks)
+        << " chunks";
+    if (get(stats.validated) > 0) {
+        out << " (" << get(stats.chunks_valid) << " valid, "
+            << get(stats.chunks_coords) << " with coordinates, "
+            << get(stats.chunks_rejected) << " rejected)";
+    }
+    out << "\n";
+    out.flags(flags);
+    out.precision(precision);
+}
+
+} // namespace mcarve
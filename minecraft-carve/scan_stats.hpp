@@ -0,0 +1,89 @@
+#ifndef SCAN_STATS_H_
+#define SCAN_STATS_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace mcarve {
+
+//! Counters of a scan.  The scanner adds to them once per shard, and they
+//! may be read from any thread while it runs.  Stage times are summed over
+//! the threads, in nanoseconds.
+struct ScanStats {
+    //! Blocks in the scanned range, and those that scan_extents() left.
+    std::atomic<uint64_t> range_blocks{0};
+    std::atomic<uint64_t> extent_blocks{0};
+    //! Time to find the extents, e.g. in the libext2fs block bitmaps.
+    std::atomic<uint64_t> extents_ns{0};
+
+    std::atomic<uint64_t> blocks_read{0};
+    //! Blocks read that were all zeros and so not classified.
+    std::atomic<uint64_t> zero_blocks{0};
+    //! Time spent reading, or waiting for a streaming reader.
+    std::atomic<uint64_t> read_ns{0};
+    std::atomic<uint64_t> classify_ns{0};
+    std::atomic<uint64_t> validate_ns{0};
+
+    //! Blocks accepted by each classifier.
+    std::atomic<uint64_t> timestamps{0};
+    std::atomic<uint64_t> offsets{0};
+    std::atomic<uint64_t> chunks{0};
+    //! Chunk starts inflated, and the outcomes.
+    std::atomic<uint64_t> validated{0};
+    std::atomic<uint64_t> chunks_valid{0};
+    std::atomic<uint64_t> chunks_rejected{0};
+    std::atomic<uint64_t> chunks_coords{0};
+    std::atomic<uint64_t> candidates{0};
+
+    //! Shards handed to a worker, and shards passed on in order.  The
+    //! difference is the number of shards in flight.
+    std::atomic<uint64_t> shards_started{0};
+    std::atomic<uint64_t> shards_done{0};
+};
+
+//! Writes the counters of a running scan as JSON lines: one every
+//! `interval`, and a last one, marked "final", from finish().  Rates are
+//! given both for the whole scan and for the time since the line before.
+class ScanStatsReporter {
+  public:
+    //! Appends to `filename`, which may name a pipe or /dev/fd/N.
+    ScanStatsReporter(const ScanStats &stats, const std::string &filename,
+                      std::chrono::milliseconds interval);
+    ~ScanStatsReporter();
+    ScanStatsReporter(const ScanStatsReporter &) = delete;
+    ScanStatsReporter &operator=(const ScanStatsReporter &) = delete;
+
+    //! Stops the periodic lines and writes the final one.
+    void finish();
+
+  private:
+    void run();
+    void write_line(bool final);
+
+    using Clock = std::chrono::steady_clock;
+
+    const ScanStats &m_stats;
+    std::ofstream m_out;
+    std::chrono::milliseconds m_interval;
+    Clock::time_point m_start;
+    Clock::time_point m_last;
+    uint64_t m_last_blocks = 0;
+    std::mutex m_mtx;
+    std::condition_variable m_cv;
+    bool m_stop = false;
+    std::thread m_thread;
+};
+
+//! Prints a human-readable summary of the counters.
+void print_scan_stats(std::ostream &out, const ScanStats &stats,
+                      double seconds);
+
+} // namespace mcarve
+
+#endif // SCAN_STATS_H_
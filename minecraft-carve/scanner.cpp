@@ -0,0 +1,376 @@
+// scanner.cpp
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "chunk_validate.hpp"
+#include "parallel.hpp"
+#include "scanner.hpp"
+#include "sector.hpp"
+
+namespace mcarve {
+
+namespace {
+
+struct BlockRun {
+    uint64_t first;
+    std::span<const unsigned char> data;
+    //! End of the scan extent that the run was cut from.
+    uint64_t extent_end;
+};
+
+//! Fetches `count` blocks starting at `first` from the reader.
+using ReadBlocks =
+    std::function<std::span<const unsigned char>(uint64_t, uint64_t)>;
+
+using Clock = std::chrono::steady_clock;
+
+uint64_t ns_between(Clock::time_point start, Clock::time_point stop) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start)
+        .count();
+}
+
+uint64_t ns_since(Clock::time_point start) {
+    return ns_between(start, Clock::now());
+}
+
+//! ScanStats counters of one shard, gathered without atomics.
+struct ShardCounters {
+    uint64_t blocks = 0;
+    uint64_t zero_blocks = 0;
+    uint64_t read_ns = 0;
+    uint64_t classify_ns = 0;
+    uint64_t validate_ns = 0;
+    uint64_t timestamps = 0;
+    uint64_t offsets = 0;
+    uint64_t chunks = 0;
+    uint64_t validated = 0;
+    uint64_t chunks_valid = 0;
+    uint64_t chunks_rejected = 0;
+    uint64_t chunks_coords = 0;
+    uint64_t candidates = 0;
+
+    void add_to(ScanStats &stats) const {
+        constexpr auto relaxed = std::memory_order_relaxed;
+        stats.blocks_read.fetch_add(blocks, relaxed);
+        stats.zero_blocks.fetch_add(zero_blocks, relaxed);
+        stats.read_ns.fetch_add(read_ns, relaxed);
+        stats.classify_ns.fetch_add(classify_ns, relaxed);
+        stats.validate_ns.fetch_add(validate_ns, relaxed);
+        stats.timestamps.fetch_add(timestamps, relaxed);
+        stats.offsets.fetch_add(offsets, relaxed);
+        stats.chunks.fetch_add(chunks, relaxed);
+        stats.validated.fetch_add(validated, relaxed);
+        stats.chunks_valid.fetch_add(chunks_valid, relaxed);
+        stats.chunks_rejected.fetch_add(chunks_rejected, relaxed);
+        stats.chunks_coords.fetch_add(chunks_coords, relaxed);
+        stats.candidates.fetch_add(candidates, relaxed);
+    }
+};
+
+struct ShardHits {
+    std::vector<CandidateRecord> hits;
+    uint64_t end = 0; //!< End of the last block of the shard.
+    ShardCounters counters;
+};
+
+//! Returns the data that validation of the chunk in block i of the run may
+//! read: the blocks that its length word claims, as far as its scan extent
+//! goes.  Where the run ends depends on the threads, the shard size and the
+//! reader, so blocks past it are fetched with read_more() rather than left
+//! out; that way a chunk is validated alike by every scan.
+std::span<const unsigned char> chunk_window(const BlockRun &run, uint64_t i,
+                                            uint32_t length,
+                                            const ReadBlocks &read_more) {
+    // The length word counts the chunk's bytes after itself.
+    const uint64_t claimed = (uint64_t{length} + 4 + BLOCKSIZE - 1) / BLOCKSIZE;
+    const uint64_t blocks = std::min(claimed, run.extent_end - run.first - i);
+    if (i + blocks <= run.data.size() / BLOCKSIZE) {
+        return run.data.subspan(i * BLOCKSIZE, blocks * BLOCKSIZE);
+    }
+    return read_more(run.first + i, blocks);
+}
+
+//! Classifies a run of blocks.  The time it takes is added to the counters
+//! only when the scan keeps statistics, split into classification,
+//! validation and the reads of read_more().
+void classify_run(const BlockRun &run, const ScanOptions &opts,
+                  const ReadBlocks &read_more,
+                  std::vector<CandidateRecord> &hits,
+                  ShardCounters &counters) {
+    const auto run_start = opts.stats ? Clock::now() : Clock::time_point{};
+    uint64_t waited_ns = 0;
+    const uint64_t count = run.data.size() / BLOCKSIZE;
+    counters.blocks += count;
+    for (uint64_t i = 0; i < count; ++i) {
+        auto block = run.data.subspan(i * BLOCKSIZE, BLOCKSIZE);
+        // Zeroed free space is common and matches none of the classifiers,
+        // so it is dropped before they look at it.
+        if (is_all_zero(block)) {
+            ++counters.zero_blocks;
+            continue;
+        }
+        uint8_t types = classify_sector(block, opts.min_time, opts.max_time);
+        ChunkTags tags;
+        if (types & SECTOR_CHUNK) {
+            ++counters.chunks;
+        }
+        if ((types & SECTOR_CHUNK) && opts.validate_chunks) {
+            thread_local ChunkValidator validator;
+            auto start = opts.stats ? Clock::now() : Clock::time_point{};
+            const auto window = chunk_window(
+                run, i, encoded_chunk_length(block), read_more);
+            if (opts.stats) {
+                const auto fetched = Clock::now();
+                counters.read_ns += ns_between(start, fetched);
+                waited_ns += ns_between(start, fetched);
+                start = fetched;
+            }
+            // The index keeps only the coordinates, so inflation stops
+            // once they are found.
+            const ChunkStatus status =
+                validator.validate(window, &tags, TAG_X_POS | TAG_Z_POS);
+            if (opts.stats) {
+                const uint64_t ns = ns_since(start);
+                counters.validate_ns += ns;
+                waited_ns += ns;
+            }
+            ++counters.validated;
+            switch (status) {
+            case ChunkStatus::VALID:
+                types |= SECTOR_CHUNK_VALID;
+                ++counters.chunks_valid;
+                break;
+            case ChunkStatus::INFLATE_ERROR:
+            case ChunkStatus::NOT_NBT:
+                types &= ~SECTOR_CHUNK;
+                ++counters.chunks_rejected;
+                break;
+            case ChunkStatus::TRUNCATED:
+                break;
+            }
+        }
+        if (types & SECTOR_TIMESTAMPS) {
+            ++counters.timestamps;
+        }
+        if (types & SECTOR_OFFSETS) {
+            ++counters.offsets;
+        }
+        if (types == 0) {
+            continue;
+        }
+        CandidateRecord rec{};
+        rec.blknum = run.first + i;
+        rec.types = types;
+        if (types & SECTOR_CHUNK) {
+            rec.chunk_length = encoded_chunk_length(block);
+        }
+        if ((tags.found & (TAG_X_POS | TAG_Z_POS)) ==
+            (TAG_X_POS | TAG_Z_POS)) {
+            ++counters.chunks_coords;
+            rec.types |= SECTOR_CHUNK_COORDS;
+            rec.x_pos = tags.x_pos;
+            rec.z_pos = tags.z_pos;
+        }
+        if (types & (SECTOR_OFFSETS | SECTOR_TIMESTAMPS)) {
+            rec.presence_hash = presence_hash(presence_bitmap(block));
+        }
+        hits.push_back(rec);
+        ++counters.candidates;
+    }
+    if (opts.stats) {
+        counters.classify_ns += ns_since(run_start) - waited_ns;
+    }
+}
+
+//! Returns a ReadBlocks that reads into a buffer of the calling thread,
+//! holding `mutex` meanwhile if it is given.
+ReadBlocks read_more_blocks(BlockReader &reader, std::mutex *mutex) {
+    return [&reader, mutex](uint64_t first, uint64_t count) {
+        thread_local std::vector<unsigned char> more;
+        more.resize(count * BLOCKSIZE);
+        std::unique_lock<std::mutex> lock;
+        if (mutex) {
+            lock = std::unique_lock<std::mutex>(*mutex);
+        }
+        return reader.view_blocks(first, count, more);
+    };
+}
+
+//! Scans on the calling thread, letting the reader stream each extent so
+//! that its I/O overlaps with classification.
+void scan_serial(BlockReader &reader, std::span<const BlockExtent> extents,
+                 const ScanOptions &opts, const ScanCallback &emit) {
+    std::vector<CandidateRecord> hits;
+    const ReadBlocks read_more = read_more_blocks(reader, nullptr);
+    uint64_t extent_end = 0;
+    // The time from the end of one visit to the next is spent in the
+    // reader.  The time in emit() counts as neither reading nor
+    // classifying, as in a sharded scan.
+    Clock::time_point last_visit;
+    auto visit = [&](uint64_t blk, std::span<const unsigned char> data) {
+        ShardCounters counters;
+        if (opts.stats) {
+            counters.read_ns = ns_since(last_visit);
+        }
+        hits.clear();
+        classify_run({blk, data, extent_end}, opts, read_more, hits,
+                     counters);
+        if (opts.stats) {
+            counters.add_to(*opts.stats);
+        }
+        emit(hits, blk + data.size() / BLOCKSIZE);
+        if (opts.stats) {
+            last_visit = Clock::now();
+        }
+    };
+    for (const auto &extent : extents) {
+        if (opts.stats) {
+            last_visit = Clock::now();
+        }
+        extent_end = &extent == &extents.back()
+                         ? std::max(extent.end(), opts.last_extent_end)
+                         : extent.end();
+        reader.stream_blocks(extent.start, extent.length, opts.shard_blocks,
+                             visit);
+    }
+}
+
+//! A piece of an extent that lies within one shard.
+struct ShardPiece {
+    BlockExtent blocks;
+    uint64_t extent_end;
+};
+
+//! Cuts the extents into pieces and groups them into shards of at most
+//! `shard_blocks` blocks.  Shard i holds pieces[bounds[i]] up to, but not
+//! including, pieces[bounds[i + 1]].  The last extent is taken to end at
+//! `last_extent_end`, if that is further.
+void make_shards(std::span<const BlockExtent> extents, uint64_t shard_blocks,
+                 uint64_t last_extent_end, std::vector<ShardPiece> &pieces,
+                 std::vector<std::size_t> &bounds) {
+    uint64_t fill = 0;
+    bounds.push_back(0);
+    for (std::size_t e = 0; e < extents.size(); ++e) {
+        auto extent = extents[e];
+        const uint64_t extent_end =
+            e + 1 == extents.size() ? std::max(extent.end(), last_extent_end)
+                                    : extent.end();
+        while (extent.length > 0) {
+            if (fill == shard_blocks) {
+                bounds.push_back(pieces.size());
+                fill = 0;
+            }
+            uint64_t n = std::min(extent.length, shard_blocks - fill);
+            pieces.push_back({{extent.start, n}, extent_end});
+            extent.start += n;
+            extent.length -= n;
+            fill += n;
+        }
+    }
+    if (fill > 0) {
+        bounds.push_back(pieces.size());
+    }
+}
+
+} // namespace
+
+std::vector<BlockExtent> find_scan_extents(BlockReader &reader,
+                                           uint64_t first, uint64_t last,
+                                           ScanStats *stats) {
+    const auto start = Clock::now();
+    std::vector<BlockExtent> extents = reader.scan_extents(first, last);
+    if (stats) {
+        uint64_t blocks = 0;
+        for (const auto &extent : extents) {
+            blocks += extent.length;
+        }
+        stats->extents_ns += ns_since(start);
+        stats->range_blocks += last > first ? last - first : 0;
+        stats->extent_blocks += blocks;
+    }
+    return extents;
+}
+
+void scan_blocks(BlockReader &reader, uint64_t first, uint64_t last,
+                 const ScanOptions &opts, const ScanCallback &emit) {
+    scan_blocks(reader, find_scan_extents(reader, first, last, opts.stats),
+                opts, emit);
+}
+
+void scan_blocks(BlockReader &reader, std::span<const BlockExtent> extents,
+                 const ScanOptions &opts, const ScanCallback &emit) {
+    if (opts.threads <= 1) {
+        scan_serial(reader, extents, opts, emit);
+        return;
+    }
+
+    const uint64_t shard_blocks = std::max<uint64_t>(opts.shard_blocks, 1);
+    std::vector<ShardPiece> pieces;
+    std::vector<std::size_t> bounds;
+    make_shards(extents, shard_blocks, opts.last_extent_end, pieces, bounds);
+    std::mutex reader_mutex;
+    const ReadBlocks read_more = read_more_blocks(
+        reader, reader.concurrent_reads() ? nullptr : &reader_mutex);
+
+    auto work = [&](std::size_t shard) {
+        thread_local std::vector<unsigned char> scratch;
+        thread_local std::vector<BlockRun> runs;
+
+        scratch.resize(shard_blocks * BLOCKSIZE);
+        runs.clear();
+        ShardHits result;
+        Clock::time_point start;
+        if (opts.stats) {
+            opts.stats->shards_started.fetch_add(1,
+                                                 std::memory_order_relaxed);
+            start = Clock::now();
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(reader_mutex, std::defer_lock);
+            if (!reader.concurrent_reads()) {
+                lock.lock();
+            }
+            // Fetch each piece with a single call.  The reader may hand back
+            // a view of its own memory; otherwise the piece lands in this
+            // thread's scratch buffer.
+            std::size_t used = 0;
+            for (auto i = bounds[shard]; i < bounds[shard + 1]; ++i) {
+                const auto &piece = pieces[i].blocks;
+                std::span<unsigned char> dst(scratch.data() + used,
+                                             piece.length * BLOCKSIZE);
+                runs.push_back({piece.start,
+                                reader.view_blocks(piece.start, piece.length,
+                                                   dst),
+                                pieces[i].extent_end});
+                used += piece.length * BLOCKSIZE;
+            }
+        }
+
+        if (opts.stats) {
+            // Includes waiting for the reader lock.
+            result.counters.read_ns = ns_since(start);
+        }
+        for (const auto &run : runs) {
+            classify_run(run, opts, read_more, result.hits, result.counters);
+        }
+        result.end = pieces[bounds[shard + 1] - 1].blocks.end();
+        return result;
+    };
+
+    ordered_parallel_for<ShardHits>(
+        bounds.size() - 1, opts.threads, work, [&](ShardHits &&result) {
+            if (opts.stats) {
+                result.counters.add_to(*opts.stats);
+                opts.stats->shards_done.fetch_add(1,
+                                                  std::memory_order_relaxed);
+            }
+            emit(result.hits, result.end);
+        });
+}
+
+} // namespace mcarve
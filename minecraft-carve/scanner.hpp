@@ -0,0 +1,76 @@
+#ifndef SCANNER_H_
+#define SCANNER_H_
+
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <vector>
+
+#include "BlockReader.hpp"
+#include "candidates.hpp"
+#include "extent.hpp"
+#include "scan_stats.hpp"
+
+namespace mcarve {
+
+struct ScanOptions {
+    uint32_t min_time = 0;
+    uint32_t max_time = UINT32_MAX;
+    //! Number of classifier threads.  Zero or one scans on the calling thread.
+    unsigned threads = 1;
+    //! Number of blocks per shard of work handed to a thread.  Each piece of
+    //! an extent within a shard is fetched with one view_blocks().
+    uint64_t shard_blocks = 1024;
+    //! Inflate the start of each candidate chunk.  Chunks that inflate to NBT
+    //! are flagged SECTOR_CHUNK_VALID, and those that fail lose SECTOR_CHUNK.
+    //! Valid chunks whose xPos and zPos are found also get
+    //! SECTOR_CHUNK_COORDS and their coordinates.  Validation reads the
+    //! blocks that a chunk's length word claims, as far as its extent goes,
+    //! however the extent is cut into shards or batches.
+    bool validate_chunks = false;
+    //! End of the extent that the last of the given extents was cut from,
+    //! when the scan is one part of a larger one that goes on past it.
+    //! Validation near the cut then reads as far as the larger scan would.
+    uint64_t last_extent_end = 0;
+    //! Counters to keep up to date during the scan, if any.  Timing the
+    //! stages costs a few clock reads per shard.
+    ScanStats *stats = nullptr;
+};
+
+//! Most blocks that validation reads for one chunk: those of a chunk of the
+//! largest length that has_encoded_chunk() accepts, 1 MiB.
+inline constexpr uint64_t MAX_CHUNK_WINDOW =
+    ((1 << 20) + 4 + BLOCKSIZE - 1) / BLOCKSIZE;
+
+//! Receives the candidates of one shard, and the block up to which the scan
+//! is complete: every block of the extents below it has been classified.
+//! Shards are delivered in block order.
+using ScanCallback =
+    std::function<void(std::span<const CandidateRecord>, uint64_t)>;
+
+//! Returns reader.scan_extents(first, last).  The time it took and the
+//! block counts are added to `stats`, if given.
+std::vector<BlockExtent> find_scan_extents(BlockReader &reader,
+                                           uint64_t first, uint64_t last,
+                                           ScanStats *stats = nullptr);
+
+//! Classifies the blocks in [first, last) that the reader's scan_extents()
+//! reports as worth scanning, i.e. the free space of a filesystem.
+void scan_blocks(BlockReader &reader, uint64_t first, uint64_t last,
+                 const ScanOptions &opts, const ScanCallback &emit);
+
+//! Classifies the blocks of the given sorted extents.
+//!
+//! The extents are split into shards which are read and classified on a pool
+//! of threads.  Calls to the reader are serialized unless it reports
+//! concurrent_reads().  With a single thread, each extent is instead passed
+//! through the reader's stream_blocks(), so readers with asynchronous I/O
+//! keep the device busy while the calling thread classifies.  The candidates
+//! are passed to emit() on the calling thread in ascending block order, so the
+//! result is the same for any thread count.
+void scan_blocks(BlockReader &reader, std::span<const BlockExtent> extents,
+                 const ScanOptions &opts, const ScanCallback &emit);
+
+} // namespace mcarve
+
+#endif // SCANNER_H_
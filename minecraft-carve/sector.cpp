@@ -1,25 +1,225 @@
 // sector.cpp
 
 #include <algorithm>
-#include <map>
+#include <array>
+#include <cstring>
 #include <span>
 #include <stdexcept>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MCARVE_X86 1
+#endif
+
 #include "sector.hpp"
 
 namespace mcarve {
 
-bool is_mostly_zero(const std::span<unsigned char> buffer) {
+namespace {
+
+//! Result of the single pass over a block made by classify_sector().
+struct Prefilter {
+    bool offsets; //!< Every big-endian word has a zero high byte.
+    bool times;   //!< Every nonzero word lies within [min_time, max_time].
+    bool nonzero; //!< Some word is nonzero.
+};
+
+using PrefilterFn = Prefilter (*)(std::span<const unsigned char>, uint32_t,
+                                  uint32_t);
+
+Prefilter prefilter_scalar(std::span<const unsigned char> buffer,
+                           uint32_t min_time, uint32_t max_time) {
     std::span<const uint32_t> buf_u32(
         reinterpret_cast<const uint32_t *>(buffer.data()),
         buffer.size() / sizeof(uint32_t));
-    constexpr int threshold = 10;
-    int nonzero_count = std::count_if(buf_u32.begin(), buf_u32.end(),
-                                      [](uint8_t x) { return x != 0; });
-    return nonzero_count < threshold;
+    uint32_t high_bytes = 0;
+    uint32_t bits = 0;
+    bool times_ok = true;
+    for (std::size_t i = 0; i < buf_u32.size(); ++i) {
+        const uint32_t word = __builtin_bswap32(buf_u32[i]);
+        high_bytes |= word >> 24;
+        bits |= word;
+        if (word != 0 && (word < min_time || word > max_time)) {
+            times_ok = false;
+        }
+        if ((i & 7) == 7 && high_bytes != 0 && !times_ok) {
+            break;
+        }
+    }
+    return {high_bytes == 0, times_ok && bits != 0, bits != 0};
+}
+
+#ifdef MCARVE_X86
+__attribute__((target("avx2"))) Prefilter
+prefilter_avx2(std::span<const unsigned char> buffer, uint32_t min_time,
+               uint32_t max_time) {
+    const std::size_t vec_bytes = buffer.size() & ~std::size_t{31};
+    const __m256i bswap = _mm256_setr_epi8(
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12, 3, 2, 1, 0, 7, 6,
+        5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    // Unsigned comparisons, done as signed comparisons after flipping the
+    // sign bit.
+    const __m256i sign = _mm256_set1_epi32(INT32_MIN);
+    const __m256i lo = _mm256_set1_epi32(min_time ^ 0x80000000u);
+    const __m256i hi = _mm256_set1_epi32(max_time ^ 0x80000000u);
+    // In memory, the high byte of a big-endian word is the low byte of the
+    // native little-endian word.
+    const __m256i high_byte = _mm256_set1_epi32(0xff);
+    const __m256i zero = _mm256_setzero_si256();
+
+    __m256i high_bytes = zero;
+    __m256i bad_times = zero;
+    __m256i bits = zero;
+    std::size_t pos = 0;
+    for (; pos < vec_bytes; pos += 32) {
+        const __m256i raw = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i *>(buffer.data() + pos));
+        high_bytes = _mm256_or_si256(high_bytes,
+                                     _mm256_and_si256(raw, high_byte));
+        bits = _mm256_or_si256(bits, raw);
+
+        const __m256i word = _mm256_xor_si256(
+            _mm256_shuffle_epi8(raw, bswap), sign);
+        const __m256i out_of_range = _mm256_or_si256(
+            _mm256_cmpgt_epi32(lo, word), _mm256_cmpgt_epi32(word, hi));
+        const __m256i is_zero = _mm256_cmpeq_epi32(raw, zero);
+        bad_times = _mm256_or_si256(bad_times,
+                                    _mm256_andnot_si256(is_zero, out_of_range));
+
+        if (!_mm256_testz_si256(high_bytes, high_bytes) &&
+            !_mm256_testz_si256(bad_times, bad_times)) {
+            return {false, false, true};
+        }
+    }
+
+    Prefilter result{bool(_mm256_testz_si256(high_bytes, high_bytes)),
+                     bool(_mm256_testz_si256(bad_times, bad_times)),
+                     !_mm256_testz_si256(bits, bits)};
+    if (pos < buffer.size()) {
+        Prefilter tail =
+            prefilter_scalar(buffer.subspan(pos), min_time, max_time);
+        result.offsets &= tail.offsets;
+        result.nonzero |= tail.nonzero;
+        result.times &= tail.times || !tail.nonzero;
+    }
+    result.times &= result.nonzero;
+    return result;
+}
+#endif
+
+PrefilterFn select_prefilter() {
+#ifdef MCARVE_X86
+    if (__builtin_cpu_supports("avx2")) {
+        return prefilter_avx2;
+    }
+#endif
+    return prefilter_scalar;
+}
+
+const PrefilterFn prefilter = select_prefilter();
+
+using WordCountFn = std::size_t (*)(std::span<const unsigned char>,
+                                    std::size_t);
+
+std::size_t count_nonzero_scalar(std::span<const unsigned char> buffer,
+                                 std::size_t limit) {
+    const unsigned char *p = buffer.data();
+    std::size_t size = buffer.size();
+    std::size_t count = 0;
+    // Take 64 bytes at a time, as eight words or'ed together, and count
+    // their 32-bit halves only when some bit is set.
+    for (; size >= 64; p += 64, size -= 64) {
+        uint64_t words[8];
+        memcpy(words, p, sizeof(words));
+        uint64_t bits = 0;
+        for (uint64_t word : words) {
+            bits |= word;
+        }
+        if (bits == 0) {
+            continue;
+        }
+        for (uint64_t word : words) {
+            count += (uint32_t(word) != 0) + ((word >> 32) != 0);
+        }
+        if (count >= limit) {
+            return count;
+        }
+    }
+    for (; size >= 4; p += 4, size -= 4) {
+        uint32_t word;
+        memcpy(&word, p, sizeof(word));
+        count += word != 0;
+    }
+    unsigned char tail = 0;
+    for (; size > 0; ++p, --size) {
+        tail |= *p;
+    }
+    return count + (tail != 0);
+}
+
+#ifdef MCARVE_X86
+//! Returns a mask with bit i set when 32-bit word i of `v` is zero.
+__attribute__((target("avx2"))) unsigned zero_words(__m256i v) {
+    return _mm256_movemask_ps(_mm256_castsi256_ps(
+        _mm256_cmpeq_epi32(v, _mm256_setzero_si256())));
+}
+
+__attribute__((target("avx2,popcnt"))) std::size_t
+count_nonzero_avx2(std::span<const unsigned char> buffer, std::size_t limit) {
+    const unsigned char *p = buffer.data();
+    std::size_t size = buffer.size();
+    std::size_t count = 0;
+    for (; size >= 128; p += 128, size -= 128) {
+        const __m256i *v = reinterpret_cast<const __m256i *>(p);
+        const __m256i v0 = _mm256_loadu_si256(v);
+        const __m256i v1 = _mm256_loadu_si256(v + 1);
+        const __m256i v2 = _mm256_loadu_si256(v + 2);
+        const __m256i v3 = _mm256_loadu_si256(v + 3);
+        const __m256i bits =
+            _mm256_or_si256(_mm256_or_si256(v0, v1), _mm256_or_si256(v2, v3));
+        // Zero data, the common case, costs one test per 128 bytes.
+        if (_mm256_testz_si256(bits, bits)) {
+            continue;
+        }
+        const unsigned zeros = zero_words(v0) | zero_words(v1) << 8 |
+                               zero_words(v2) << 16 | zero_words(v3) << 24;
+        count += 32 - __builtin_popcount(zeros);
+        if (count >= limit) {
+            return count;
+        }
+    }
+    return count + count_nonzero_scalar({p, size}, limit - count);
+}
+#endif
+
+WordCountFn select_word_count() {
+#ifdef MCARVE_X86
+    if (__builtin_cpu_supports("avx2")) {
+        return count_nonzero_avx2;
+    }
+#endif
+    return count_nonzero_scalar;
 }
 
-bool has_timestamps(const std::span<unsigned char> buffer, uint32_t min_time,
+const WordCountFn word_count = select_word_count();
+
+} // namespace
+
+std::size_t count_nonzero_words(std::span<const unsigned char> buffer,
+                                std::size_t limit) {
+    return word_count(buffer, limit);
+}
+
+bool is_all_zero(std::span<const unsigned char> buffer) {
+    return word_count(buffer, 1) == 0;
+}
+
+bool is_mostly_zero(std::span<const unsigned char> buffer) {
+    constexpr std::size_t threshold = 10;
+    return word_count(buffer, threshold) < threshold;
+}
+
+bool has_timestamps(std::span<const unsigned char> buffer, uint32_t min_time,
                     uint32_t max_time) {
     uint32_t bits(0);
     std::span<const uint32_t> buf_u32(
@@ -35,19 +235,26 @@ bool has_timestamps(const std::span<unsigned char> buffer, uint32_t min_time,
     return bits != 0;
 }
 
-bool has_offsets(const std::span<unsigned char> buffer) {
+bool has_offsets(std::span<const unsigned char> buffer) {
+    // A region file header holds one offset entry per chunk.
+    constexpr std::size_t MAX_ENTRIES = 1024;
     std::span<const uint32_t> buf_u32(
         reinterpret_cast<const uint32_t *>(buffer.data()),
-        buffer.size() / sizeof(uint32_t));
-
-    std::map<uint32_t, uint8_t> chunk_length;
+        std::min(buffer.size() / sizeof(uint32_t), MAX_ENTRIES));
 
-    uint32_t offset_count = 0;
+    // Entries with a nonzero length, packed as offset:index:length so that
+    // sorting orders them by offset.  Fixed-size arrays keep this free of
+    // heap allocations.
+    std::array<uint64_t, MAX_ENTRIES> chunks;
+    std::size_t chunk_count = 0;
+    // Entries with a zero length, packed as offset:index.
+    std::array<uint32_t, MAX_ENTRIES> empties;
+    std::size_t empty_count = 0;
 
-    for (uint32_t field : buf_u32) {
-        field = __builtin_bswap32(field);
-        uint8_t length = field & 0xff;
-        uint32_t offset = field >> 8;
+    for (std::size_t i = 0; i < buf_u32.size(); ++i) {
+        const uint32_t field = __builtin_bswap32(buf_u32[i]);
+        const uint8_t length = field & 0xff;
+        const uint32_t offset = field >> 8;
 
         // Reject candidate offset sectors with chunk offsets that are
         // unreasonably large.  Chunk sector offset > 0xffff corresponds to a
@@ -55,34 +262,52 @@ bool has_offsets(const std::span<unsigned char> buffer) {
         if (offset > 0xffff) {
             return false;
         }
-        if (chunk_length.contains(offset)) {
-            return false;
-        }
         if (length > 0) {
-            chunk_length[offset] = length;
-            offset_count++;
+            chunks[chunk_count++] =
+                uint64_t{offset} << 32 | uint64_t{i} << 8 | length;
+        } else if (offset >= 2) {
+            // An empty entry at offset 0 or 1 can only collide with a chunk
+            // that is rejected below for overlapping the header.
+            empties[empty_count++] = offset << 16 | i;
         }
     }
 
     // Reject candidate offset sectors that have fewer than four chunks.
-    if (offset_count < 4) {
+    if (chunk_count < 4) {
         return false;
     }
 
+    std::sort(chunks.begin(), chunks.begin() + chunk_count);
+
     // Reject candidate offset sectors with offsets inconsistent with chunk
-    // lengths.
+    // lengths, or with two chunks at the same offset.
     uint32_t min_allowed_offset{2};
-
-    for (auto [offset, length] : chunk_length) {
-        if (length > 0 && offset < min_allowed_offset) {
+    uint32_t prev_offset = 0;
+    for (std::size_t i = 0; i < chunk_count; ++i) {
+        const uint32_t offset = chunks[i] >> 32;
+        const uint8_t length = chunks[i] & 0xff;
+        if (offset < min_allowed_offset || (i > 0 && offset == prev_offset)) {
             return false;
         }
         min_allowed_offset += length;
+        prev_offset = offset;
+    }
+
+    // Reject an empty entry that repeats the offset of an earlier chunk.
+    for (std::size_t i = 0; i < empty_count; ++i) {
+        const uint64_t offset = empties[i] >> 16;
+        const uint64_t index = empties[i] & 0xffff;
+        auto it = std::lower_bound(chunks.begin(), chunks.begin() + chunk_count,
+                                   offset << 32);
+        if (it != chunks.begin() + chunk_count && (*it >> 32) == offset &&
+            ((*it >> 8) & 0xffffff) < index) {
+            return false;
+        }
     }
     return true;
 }
 
-bool has_encoded_chunk(const std::span<unsigned char> buffer) {
+bool has_encoded_chunk(std::span<const unsigned char> buffer) {
     if (buffer.size() < 8) {
         return false;
     }
@@ -107,4 +332,66 @@ bool has_encoded_chunk(const std::span<unsigned char> buffer) {
     return ((__builtin_bswap32(buf_u32[1]) & 0xFFFFFF00) == COMP_CMF_FLG);
 }
 
+
+PresenceBitmap presence_bitmap(std::span<const unsigned char> buffer) {
+    std::span<const uint32_t> buf_u32(
+        reinterpret_cast<const uint32_t *>(buffer.data()),
+        std::min(buffer.size() / sizeof(uint32_t), std::size_t{1024}));
+    PresenceBitmap bitmap{};
+    for (std::size_t i = 0; i < buf_u32.size(); ++i) {
+        if (buf_u32[i] != 0) {
+            bitmap[i / 8] |= 1 << (i % 8);
+        }
+    }
+    return bitmap;
+}
+
+uint64_t presence_hash(const PresenceBitmap &bitmap) {
+    uint64_t hash = 0xcbf29ce484222325;
+    for (uint8_t byte : bitmap) {
+        hash ^= byte;
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+uint32_t encoded_chunk_length(std::span<const unsigned char> buffer) {
+    if (buffer.size() < sizeof(uint32_t)) {
+        return 0;
+    }
+    uint32_t length;
+    memcpy(&length, buffer.data(), sizeof(length));
+    return __builtin_bswap32(length);
+}
+
+uint8_t classify_sector(std::span<const unsigned char> buffer,
+                        uint32_t min_time, uint32_t max_time) {
+    uint8_t types = 0;
+    if (has_encoded_chunk(buffer)) {
+        types |= SECTOR_CHUNK;
+    }
+    if (buffer.size() < sizeof(uint32_t)) {
+        return types;
+    }
+
+    // Most blocks are already ruled out as both tables by their first word.
+    uint32_t first;
+    memcpy(&first, buffer.data(), sizeof(first));
+    first = __builtin_bswap32(first);
+    if ((first >> 24) != 0 && (first < min_time || first > max_time)) {
+        return types;
+    }
+
+    const Prefilter pf = prefilter(buffer, min_time, max_time);
+    if (pf.times) {
+        types |= SECTOR_TIMESTAMPS;
+    }
+    // An offset table needs at least four nonzero entries, all with a zero
+    // high byte; only then is the full validation worth running.
+    if (pf.offsets && pf.nonzero && has_offsets(buffer)) {
+        types |= SECTOR_OFFSETS;
+    }
+    return types;
+}
+
 } // namespace mcarve
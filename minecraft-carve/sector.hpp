@@ -11,23 +11,66 @@
 #ifndef SECTOR_H_
 #define SECTOR_H_
 
+#include <array>
+#include <cstddef>
 #include <cstdint>
 #include <span>
 
 namespace mcarve {
 
+//! Bit flags for the candidate sector types recognized in pass 1.
+enum SectorType : uint8_t {
+    SECTOR_TIMESTAMPS = 1 << 0,
+    SECTOR_OFFSETS = 1 << 1,
+    SECTOR_CHUNK = 1 << 2,
+    //! An encoded chunk whose data inflates to NBT.
+    SECTOR_CHUNK_VALID = 1 << 3,
+    //! A valid chunk whose coordinates were read from its NBT.
+    SECTOR_CHUNK_COORDS = 1 << 4,
+};
+
+//! Counts the nonzero 32-bit words of a byte buffer, a partial word at the
+//! end counting as one.  Counting stops once `limit` are found, so a caller
+//! that only needs to know whether there are fewer reads no further than it
+//! must.  Zero data is skipped at memory bandwidth; AVX2 is used when the
+//! CPU supports it.
+std::size_t count_nonzero_words(std::span<const unsigned char> buffer,
+                                std::size_t limit = SIZE_MAX);
+
+//! Tests if a byte buffer is all zeros.
+bool is_all_zero(std::span<const unsigned char> buffer);
+
 //! Tests if a byte buffer has less than 10 nonzero 32-bit words.
-bool is_mostly_zero(const std::span<unsigned char> buffer);
+bool is_mostly_zero(std::span<const unsigned char> buffer);
 
 //! Tests if a byte buffer could be a big-endian 32-bit timestamp table.
-bool has_timestamps(const std::span<unsigned char> buffer, uint32_t min_time,
+bool has_timestamps(std::span<const unsigned char> buffer, uint32_t min_time,
                     uint32_t max_time);
 
 //! Tests if a byte buffer could be a sector offset table.
-bool has_offsets(const std::span<unsigned char> buffer);
+bool has_offsets(std::span<const unsigned char> buffer);
 
 //! Tests if a byte buffer could be the beginning of an encoded chunk.
-bool has_encoded_chunk(const std::span<unsigned char> buffer);
+bool has_encoded_chunk(std::span<const unsigned char> buffer);
+
+//! Bit i is set when 32-bit word i of a header table is nonzero, i.e. when
+//! chunk i is present in the region file.
+using PresenceBitmap = std::array<uint8_t, 128>;
+
+//! Computes the chunk presence bitmap of an offset or timestamp table.
+PresenceBitmap presence_bitmap(std::span<const unsigned char> buffer);
+
+//! Hashes a presence bitmap to 64 bits (FNV-1a).
+uint64_t presence_hash(const PresenceBitmap &bitmap);
+
+//! Returns the length word at the start of an encoded chunk.
+uint32_t encoded_chunk_length(std::span<const unsigned char> buffer);
+
+//! Classifies a block in a single pass and returns the SectorType flags of
+//! the tests above that accept it.  Most blocks are rejected after the
+//! first few words; AVX2 is used when the CPU supports it.
+uint8_t classify_sector(std::span<const unsigned char> buffer,
+                        uint32_t min_time, uint32_t max_time);
 
 } // namespace mcarve
 #endif // SECTOR_H_
@@ -0,0 +1,117 @@
+// synthetic.cpp
+
+#include <stdexcept>
+#include <string>
+
+#include <zlib.h>
+
+#include "synthetic.hpp"
+
+namespace mcarve {
+
+namespace {
+
+class NbtWriter {
+  public:
+    explicit NbtWriter(std::mt19937 &rng) : m_rng(rng) {}
+
+    std::vector<unsigned char> chunk(int32_t x_pos, int32_t z_pos,
+                                     bool coords_last) {
+        m_out.clear();
+        tag(10, "");
+        tag(3, "DataVersion");
+        be(3465, 4);
+        if (!coords_last) {
+            coords(x_pos, z_pos);
+        }
+        tag(4, "LastUpdate");
+        be(m_rng() % 1000000, 8);
+        tag(4, "InhabitedTime");
+        be(m_rng() % 100000, 8);
+        tag(8, "Status");
+        str("minecraft:full");
+        tag(9, "sections");
+        m_out.push_back(10);
+        constexpr int SECTIONS = 24;
+        be(SECTIONS, 4);
+        for (int s = 0; s < SECTIONS; ++s) {
+            tag(1, "Y");
+            m_out.push_back(s - 4);
+            tag(10, "block_states");
+            tag(9, "palette");
+            m_out.push_back(10);
+            const int palette = 1 + m_rng() % 8;
+            be(palette, 4);
+            for (int p = 0; p < palette; ++p) {
+                tag(8, "Name");
+                str("minecraft:block_" + std::to_string(m_rng() % 40));
+                m_out.push_back(0);
+            }
+            tag(12, "data");
+            be(256, 4);
+            for (int i = 0; i < 256; ++i) {
+                // Block states repeat a lot, which is what makes chunks
+                // compress well.
+                be(m_rng() % 4 == 0 ? m_rng() : 0x1111111111111111ull, 8);
+            }
+            m_out.push_back(0);
+            m_out.push_back(0);
+        }
+        if (coords_last) {
+            coords(x_pos, z_pos);
+        }
+        m_out.push_back(0);
+        return std::move(m_out);
+    }
+
+  private:
+    void coords(int32_t x_pos, int32_t z_pos) {
+        tag(3, "xPos");
+        be(x_pos, 4);
+        tag(3, "zPos");
+        be(z_pos, 4);
+    }
+    void be(uint64_t v, int bytes) {
+        for (int i = bytes - 1; i >= 0; --i) {
+            m_out.push_back(v >> (8 * i));
+        }
+    }
+    void str(const std::string &s) {
+        be(s.size(), 2);
+        m_out.insert(m_out.end(), s.begin(), s.end());
+    }
+    void tag(uint8_t type, const std::string &name) {
+        m_out.push_back(type);
+        str(name);
+    }
+
+    std::mt19937 &m_rng;
+    std::vector<unsigned char> m_out;
+};
+
+} // namespace
+
+std::vector<unsigned char> synthetic_chunk(std::mt19937 &rng, int32_t x_pos,
+                                           int32_t z_pos, bool coords_last) {
+    return NbtWriter(rng).chunk(x_pos, z_pos, coords_last);
+}
+
+std::vector<unsigned char> encode_chunk(std::span<const unsigned char> nbt,
+                                        int level) {
+    uLongf size = compressBound(nbt.size());
+    std::vector<unsigned char> out(5 + size);
+    if (compress2(out.data() + 5, &size, nbt.data(), nbt.size(), level) !=
+        Z_OK) {
+        throw std::runtime_error("Failed to compress chunk");
+    }
+    const uint32_t length = size + 1;
+    out[0] = length >> 24;
+    out[1] = length >> 16;
+    out[2] = length >> 8;
+    out[3] = length;
+    out[4] = 0x02;
+    out.resize(5 + size);
+    return out;
+}
+
+} // namespace mcarve
@@ -0,0 +1,28 @@
+#ifndef SYNTHETIC_H_
+#define SYNTHETIC_H_
+
+#include <cstdint>
+#include <random>
+#include <span>
+#include <vector>
+
+namespace mcarve {
+
+//! Returns big-endian NBT of roughly the shape of a chunk: the scalars
+//! NbtProbe looks for, then 24 sections with a block palette and packed
+//! block states.  About a quarter of the block state words are random, so
+//! the chunk compresses to a few sectors, as real ones do.  The game writes
+//! tags in no fixed order; with `coords_last`, xPos and zPos follow the
+//! sections, so they are only found by inflating the whole chunk.
+std::vector<unsigned char> synthetic_chunk(std::mt19937 &rng, int32_t x_pos,
+                                           int32_t z_pos,
+                                           bool coords_last = false);
+
+//! Encodes chunk NBT the way a region file stores it: the length word,
+//! compression type 2 and the zlib stream, without the sector padding.
+std::vector<unsigned char> encode_chunk(std::span<const unsigned char> nbt,
+                                        int level);
+
+} // namespace mcarve
+
+#endif // SYNTHETIC_H_
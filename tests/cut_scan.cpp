@@ -0,0 +1,72 @@
+// Cuts a finished mcarve index back to a block, and writes the checkpoint
+// that a scan interrupted there would have left, so that `mcarve --resume`
+// can be tested without killing a scan at the right moment.
+
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include "CLI11/CLI11.hpp"
+
+#include "BlockReader.hpp"
+#include "candidates.hpp"
+#include "checkpoint.hpp"
+
+using namespace mcarve;
+
+int main(int argc, char **argv) {
+    CLI::App app{"Cut an mcarve index back as if its scan was interrupted"};
+
+    std::string index_file;
+    uint64_t blocks = 0;
+    uint64_t scanned_to = 0;
+    unsigned batch_mib = 4;
+    bool validate = false;
+    app.add_option("-i,--index", index_file, "Index of a whole-image scan")
+        ->required();
+    app.add_option("--blocks", blocks, "Number of blocks of the image")
+        ->required();
+    app.add_option("--at", scanned_to, "Block the scan was interrupted at")
+        ->required();
+    app.add_option("--batch", batch_mib, "--batch of the scan, in MiB")
+        ->capture_default_str();
+    app.add_flag("--validate", validate, "The scan was run with --validate");
+    CLI11_PARSE(app, argc, argv);
+
+    try {
+        ScanCheckpoint checkpoint = make_checkpoint();
+        {
+            CandidateIndex index(index_file);
+            for (const auto &record : index.records()) {
+                if (record.blknum >= scanned_to) {
+                    break;
+                }
+                ++checkpoint.record_count;
+            }
+            checkpoint.min_time = index.header().min_time;
+            checkpoint.max_time = index.header().max_time;
+        }
+        const BlockExtent range{0, blocks};
+        checkpoint.scanned_to = scanned_to;
+        checkpoint.first = range.start;
+        checkpoint.last = range.end();
+        checkpoint.ranges_hash = hash_ranges({&range, 1});
+        checkpoint.shard_blocks =
+            batch_mib * (uint64_t{1} << 20) / BLOCKSIZE;
+        checkpoint.validate_chunks = validate;
+
+        // Drop the records after the checkpoint; the resumed scan must
+        // write them again.
+        std::filesystem::resize_file(
+            index_file, sizeof(CandidateIndexHeader) +
+                            checkpoint.record_count * sizeof(CandidateRecord));
+        save_checkpoint(index_file + ".checkpoint", checkpoint);
+    } catch (const std::exception &e) {
+        std::cerr << argv[0] << ": " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return 0;
+}
@@ -0,0 +1,74 @@
+# Checks that a scan split by `mcarve plan`, scanned unit by unit and put
+# together by `mcarve merge` writes the same index as a single scan.  Units
+# scanned on different thread counts must agree too.
+
+file(REMOVE_RECURSE ${WORK_DIR})
+file(MAKE_DIRECTORY ${WORK_DIR})
+
+execute_process(
+    COMMAND ${MAKE_TEST_IMAGE} -o img.raw -s 1G -m manifest.txt -n 12
+            --coords-last 50 --seed 7
+    WORKING_DIRECTORY ${WORK_DIR}
+    RESULT_VARIABLE result
+)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "make_test_image failed: ${result}")
+endif()
+
+execute_process(
+    COMMAND ${MCARVE} -f img.raw --stop 2030-01-01 --validate -o whole
+    WORKING_DIRECTORY ${WORK_DIR}
+    RESULT_VARIABLE result
+)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "mcarve failed: ${result}")
+endif()
+
+foreach(units 3 7)
+    execute_process(
+        COMMAND ${MCARVE} -f img.raw --stop 2030-01-01 --validate
+                plan -n ${units} -p plan${units}
+        WORKING_DIRECTORY ${WORK_DIR}
+        RESULT_VARIABLE result
+    )
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "mcarve plan -n ${units} failed: ${result}")
+    endif()
+
+    set(parts "")
+    math(EXPR last "${units} - 1")
+    foreach(unit RANGE ${last})
+        # Alternate the thread count between the units.
+        math(EXPR threads "${unit} % 2 * 7 + 1")
+        execute_process(
+            COMMAND ${MCARVE} -f img.raw --plan plan${units} --unit ${unit}
+                    -j${threads} -o part${units}-${unit}
+            WORKING_DIRECTORY ${WORK_DIR}
+            RESULT_VARIABLE result
+        )
+        if(NOT result EQUAL 0)
+            message(FATAL_ERROR "mcarve --unit ${unit} of ${units} failed: "
+                                "${result}")
+        endif()
+        list(APPEND parts part${units}-${unit})
+    endforeach()
+
+    execute_process(
+        COMMAND ${MCARVE} -o merged${units} merge -p plan${units} ${parts}
+        WORKING_DIRECTORY ${WORK_DIR}
+        RESULT_VARIABLE result
+    )
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "mcarve merge of ${units} units failed: "
+                            "${result}")
+    endif()
+    execute_process(
+        COMMAND ${CMAKE_COMMAND} -E compare_files whole merged${units}
+        WORKING_DIRECTORY ${WORK_DIR}
+        RESULT_VARIABLE result
+    )
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "The merge of ${units} units differs from a "
+                            "single scan")
+    endif()
+endforeach()
@@ -0,0 +1,87 @@
+# Checks that `mcarve --resume` finishes an interrupted scan with the same
+# index as an uninterrupted one.  The interruption is made by cut_scan,
+# which cuts the index of a whole scan back to a block and writes the
+# checkpoint of a scan stopped there.
+
+file(REMOVE_RECURSE ${WORK_DIR})
+file(MAKE_DIRECTORY ${WORK_DIR})
+
+execute_process(
+    COMMAND ${MAKE_TEST_IMAGE} -o img.raw -s 1G -m manifest.txt -n 12
+            --coords-last 50 --seed 5
+    WORKING_DIRECTORY ${WORK_DIR}
+    RESULT_VARIABLE result
+)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "make_test_image failed: ${result}")
+endif()
+file(SIZE ${WORK_DIR}/img.raw size)
+math(EXPR blocks "${size} / 4096")
+
+execute_process(
+    COMMAND ${MCARVE} -f img.raw --stop 2030-01-01 --validate -o whole
+    WORKING_DIRECTORY ${WORK_DIR}
+    RESULT_VARIABLE result
+)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "mcarve failed: ${result}")
+endif()
+
+# Resume at the start, inside the image and at its last block, on one and
+# on several threads.
+math(EXPR third "${blocks} / 3 + 1")
+math(EXPR half "${blocks} / 2 + 7")
+math(EXPR last "${blocks} - 1")
+set(runs "0|-j1" "${third}|-j1" "${half}|-j8" "${last}|-j8")
+foreach(run IN LISTS runs)
+    string(REPLACE "|" ";" run "${run}")
+    list(GET run 0 at)
+    list(GET run 1 threads)
+    execute_process(
+        COMMAND ${CMAKE_COMMAND} -E copy whole resumed
+        WORKING_DIRECTORY ${WORK_DIR}
+    )
+    execute_process(
+        COMMAND ${CUT_SCAN} -i resumed --blocks ${blocks} --at ${at}
+                --validate
+        WORKING_DIRECTORY ${WORK_DIR}
+        RESULT_VARIABLE result
+    )
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "cut_scan --at ${at} failed: ${result}")
+    endif()
+    execute_process(
+        COMMAND ${MCARVE} -f img.raw --stop 2030-01-01 --resume ${threads}
+                -o resumed
+        WORKING_DIRECTORY ${WORK_DIR}
+        RESULT_VARIABLE result
+    )
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "mcarve --resume ${threads} at ${at} failed: "
+                            "${result}")
+    endif()
+    execute_process(
+        COMMAND ${CMAKE_COMMAND} -E compare_files whole resumed
+        WORKING_DIRECTORY ${WORK_DIR}
+        RESULT_VARIABLE result
+    )
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "Resuming at block ${at} with ${threads} wrote "
+                            "another index than a whole scan")
+    endif()
+    if(EXISTS ${WORK_DIR}/resumed.checkpoint)
+        message(FATAL_ERROR "The checkpoint was left after resuming")
+    endif()
+endforeach()
+
+# A resume without a checkpoint must fail with an error, not abort.
+execute_process(
+    COMMAND ${MCARVE} -f img.raw --resume -o whole
+    WORKING_DIRECTORY ${WORK_DIR}
+    RESULT_VARIABLE result
+    ERROR_VARIABLE error
+)
+if(NOT result EQUAL 1 OR NOT error MATCHES "Failed to open checkpoint")
+    message(FATAL_ERROR "A resume without a checkpoint gave ${result}: "
+                        "${error}")
+endif()